@@ -0,0 +1,66 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Large enough for the temporaries of all the headers of a typical message.
+const size_t kBlockSize = 8 * 1024;
+
+const size_t kAlignment = alignof(std::max_align_t);
+
+}  // namespace
+
+thread_local int ScopedArena::depth_ = 0;
+
+Arena::Arena()
+  : current_(nullptr),
+    remaining_(0) {
+}
+
+Arena::~Arena() {
+  for (char* block : blocks_)
+    std::free(block);
+}
+
+void* Arena::Allocate(size_t size) {
+  size = (size + kAlignment - 1) & ~(kAlignment - 1);
+  if (size > remaining_) {
+    size_t block_size = std::max(size, kBlockSize);
+    current_ = NewBlock(block_size);
+    remaining_ = block_size;
+  }
+  void* result = current_;
+  current_ += size;
+  remaining_ -= size;
+  return result;
+}
+
+void Arena::Reset() {
+  if (blocks_.empty())
+    return;
+  for (size_t i = 1; i < blocks_.size(); ++i)
+    std::free(blocks_[i]);
+  blocks_.resize(1);
+  current_ = blocks_[0];
+  remaining_ = kBlockSize;
+}
+
+Arena* Arena::Current() {
+  static thread_local Arena arena;
+  return &arena;
+}
+
+char* Arena::NewBlock(size_t size) {
+  char* block = static_cast<char*>(std::malloc(size));
+  if (block == nullptr)
+    throw std::bad_alloc();
+  blocks_.push_back(block);
+  return block;
+}
@@ -0,0 +1,114 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// This file intentionally does not have header guards, it's included inside
+// a macro to generate enum.
+//
+// This file contains the atoms returned by the parser, other than methods,
+// protocols and header names, which are listed in their own files.
+
+#ifndef SIP_ATOM
+#error "SIP_ATOM should be defined before including this file"
+#endif
+
+// Results and map keys.
+SIP_ATOM(ok)
+SIP_ATOM(error)
+SIP_ATOM(nil)
+SIP_ATOM(true)
+SIP_ATOM(false)
+SIP_ATOM(start_line)
+SIP_ATOM(headers)
+SIP_ATOM(body)
+SIP_ATOM(method)
+SIP_ATOM(request_uri)
+SIP_ATOM(status_code)
+SIP_ATOM(reason_phrase)
+SIP_ATOM(version)
+SIP_ATOM(folded)
+SIP_ATOM(date_fallbacks)
+SIP_ATOM(scheme)
+SIP_ATOM(user)
+SIP_ATOM(password)
+SIP_ATOM(host)
+SIP_ATOM(port)
+SIP_ATOM(parameters)
+SIP_ATOM(year)
+SIP_ATOM(month)
+SIP_ATOM(day)
+SIP_ATOM(hour)
+SIP_ATOM(minute)
+SIP_ATOM(second)
+SIP_ATOM(needs_stream_transport)
+
+// Options.
+SIP_ATOM(sub_binaries)
+SIP_ATOM(min_sub_binary_size)
+SIP_ATOM(max_pinned_size)
+SIP_ATOM(only)
+SIP_ATOM(datagram)
+SIP_ATOM(inet_addresses)
+SIP_ATOM(uris)
+SIP_ATOM(raw_headers)
+SIP_ATOM(max_message_size)
+SIP_ATOM(mtu)
+
+// Edit operations.
+SIP_ATOM(add_via)
+SIP_ATOM(received)
+SIP_ATOM(pop_route)
+SIP_ATOM(decrement_max_forwards)
+SIP_ATOM(add_record_route)
+
+// Error reasons.
+SIP_ATOM(empty_date)
+SIP_ATOM(empty_input)
+SIP_ATOM(empty_status_code)
+SIP_ATOM(empty_value)
+SIP_ATOM(empty_warn_agent)
+SIP_ATOM(invalid_char_found)
+SIP_ATOM(invalid_code)
+SIP_ATOM(invalid_comment)
+SIP_ATOM(invalid_content_length)
+SIP_ATOM(invalid_date)
+SIP_ATOM(invalid_digits)
+SIP_ATOM(invalid_line_break)
+SIP_ATOM(invalid_minor)
+SIP_ATOM(invalid_sentby)
+SIP_ATOM(invalid_sequence)
+SIP_ATOM(invalid_status_code)
+SIP_ATOM(invalid_timestamp)
+SIP_ATOM(invalid_token)
+SIP_ATOM(invalid_uri)
+SIP_ATOM(invalid_warn_text)
+SIP_ATOM(malformed_version)
+SIP_ATOM(malformed_version_number)
+SIP_ATOM(message_too_large)
+SIP_ATOM(missing_address)
+SIP_ATOM(missing_auth_scheme)
+SIP_ATOM(missing_content_length)
+SIP_ATOM(missing_delta_secs)
+SIP_ATOM(missing_major)
+SIP_ATOM(missing_method)
+SIP_ATOM(missing_or_invalid_delta_secs)
+SIP_ATOM(missing_or_invalid_major)
+SIP_ATOM(missing_sent_protocol)
+SIP_ATOM(missing_sentby)
+SIP_ATOM(missing_sequence)
+SIP_ATOM(missing_status_code)
+SIP_ATOM(missing_subtype)
+SIP_ATOM(missing_timestamp)
+SIP_ATOM(missing_uri)
+SIP_ATOM(missing_version)
+SIP_ATOM(missing_version_spec)
+SIP_ATOM(missing_via)
+SIP_ATOM(missing_warn_text)
+SIP_ATOM(multiple_definition)
+SIP_ATOM(no_memory)
+SIP_ATOM(overlapping_edits)
+SIP_ATOM(too_many_hops)
+SIP_ATOM(truncated_body)
+SIP_ATOM(unclosed_laquot)
+SIP_ATOM(unclosed_qstring)
+SIP_ATOM(unknown_version)
@@ -0,0 +1,72 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CHAR_CLASS_H_
+#define CHAR_CLASS_H_
+
+#include <cstdint>
+
+// A set of bytes, stored as a 256-bit table. Sets declared constexpr are
+// built by the compiler, so that testing a byte costs a single table load
+// instead of a search through a string of characters.
+class CharClass {
+ public:
+  constexpr CharClass() : bits_{0, 0, 0, 0} {}
+
+  // The set of the characters of the NUL-terminated string |chars|.
+  constexpr explicit CharClass(const char* chars) : bits_{0, 0, 0, 0} {
+    for (; *chars != '\0'; ++chars)
+      Add(static_cast<unsigned char>(*chars));
+  }
+
+  // The set of the bytes in [first, last].
+  static constexpr CharClass Range(unsigned char first, unsigned char last) {
+    CharClass result;
+    for (unsigned c = first; c <= last; ++c)
+      result.Add(static_cast<unsigned char>(c));
+    return result;
+  }
+
+  constexpr bool Contains(char c) const {
+    return Contains(static_cast<unsigned char>(c));
+  }
+  constexpr bool Contains(unsigned char c) const {
+    return (bits_[c >> 6] >> (c & 63)) & 1;
+  }
+
+  constexpr CharClass operator|(const CharClass& other) const {
+    CharClass result;
+    for (int i = 0; i < 4; ++i)
+      result.bits_[i] = bits_[i] | other.bits_[i];
+    return result;
+  }
+
+  // The bytes of this set that are not in |other|.
+  constexpr CharClass Without(const CharClass& other) const {
+    CharClass result;
+    for (int i = 0; i < 4; ++i)
+      result.bits_[i] = bits_[i] & ~other.bits_[i];
+    return result;
+  }
+
+ private:
+  constexpr void Add(unsigned char c) {
+    bits_[c >> 6] |= uint64_t(1) << (c & 63);
+  }
+
+  uint64_t bits_[4];
+};
+
+// SIP "linear white space" (SP | HT), as the SIP_LWS macro.
+constexpr CharClass kLWSChars(" \t");
+
+// The characters of a |token|, as defined in RFC 2616 Sec 2.2.
+constexpr CharClass kTokenChars =
+    CharClass::Range(0x20, 0x7e).Without(
+        CharClass("()<>@,;:\\\"/[]?={} \t"));
+
+// The quote marks accepted around quoted strings.
+constexpr CharClass kQuoteChars("\"'");
+
+#endif // CHAR_CLASS_H_
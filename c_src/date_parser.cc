@@ -0,0 +1,114 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "date_parser.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const char kWeekdays[] = "SunMonTueWedThuFriSat";
+const char kMonths[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+// The number of days before each month, in common years.
+const int kDaysBeforeMonth[] = {
+  0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365,
+};
+
+// Returns the index of the three letters at |p| in |names|, or -1.
+int FindName(const char* p, const char* names, int count) {
+  for (int i = 0; i < count; ++i) {
+    if (memcmp(p, names + i * 3, 3) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Reads |n| digits at |p|, returning -1 if any of them is not a digit.
+int ReadDigits(const char* p, int n) {
+  int value = 0;
+  for (int i = 0; i < n; ++i) {
+    unsigned digit = static_cast<unsigned char>(p[i]) - '0';
+    if (digit > 9)
+      return -1;
+    value = value * 10 + digit;
+  }
+  return value;
+}
+
+bool IsLeapYear(int year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+// The day of the week of a date (0-6, Sun = 0), by Sakamoto's method.
+int DayOfWeek(int year, int month, int day) {
+  static const int kMonthOffsets[] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+  if (month < 2)
+    --year;
+  return (year + year / 4 - year / 100 + year / 400 + kMonthOffsets[month]
+      + day) % 7;
+}
+
+}  // namespace
+
+bool ParseRFC1123Date(StringPiece input, PRExplodedTime* result) {
+  // "Sun, 06 Nov 1994 08:49:37 GMT"
+  //  0    5  8   12   17 20 23 26
+  if (input.size() != 29)
+    return false;
+  const char* p = input.data();
+  if (p[3] != ',' || p[4] != ' ' || p[7] != ' ' || p[11] != ' '
+      || p[16] != ' ' || p[19] != ':' || p[22] != ':' || p[25] != ' '
+      || memcmp(p + 26, "GMT", 3) != 0)
+    return false;
+
+  int weekday = FindName(p, kWeekdays, 7);
+  int month = FindName(p + 8, kMonths, 12);
+  int day = ReadDigits(p + 5, 2);
+  int year = ReadDigits(p + 12, 4);
+  int hour = ReadDigits(p + 17, 2);
+  int minute = ReadDigits(p + 20, 2);
+  int second = ReadDigits(p + 23, 2);
+  if (weekday < 0 || month < 0 || day < 1 || year < 1 || hour < 0
+      || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 59)
+    return false;
+
+  bool leap = IsLeapYear(year);
+  int days_in_month = kDaysBeforeMonth[month + 1] - kDaysBeforeMonth[month];
+  if (month == 1 && leap)
+    ++days_in_month;
+  if (day > days_in_month)
+    return false;
+
+  result->tm_usec = 0;
+  result->tm_sec = second;
+  result->tm_min = minute;
+  result->tm_hour = hour;
+  result->tm_mday = day;
+  result->tm_month = month;
+  result->tm_year = static_cast<PRInt16>(year);
+  // As with PR_NormalizeTime(), the day of the week is computed, and the
+  // name given in the input is only checked to be valid.
+  result->tm_wday = static_cast<PRInt8>(DayOfWeek(year, month, day));
+  result->tm_yday = static_cast<PRInt16>(
+      kDaysBeforeMonth[month] + (leap && month > 1 ? 1 : 0) + day - 1);
+  result->tm_params.tp_gmt_offset = 0;
+  result->tm_params.tp_dst_offset = 0;
+  return true;
+}
+
+size_t FormatRFC1123Date(const PRExplodedTime& time, char* buffer,
+    size_t size) {
+  if (time.tm_year < 1 || time.tm_month < 0 || time.tm_month > 11
+      || time.tm_mday < 1 || time.tm_mday > 31)
+    return 0;
+  int weekday = DayOfWeek(time.tm_year, time.tm_month, time.tm_mday);
+  int length = snprintf(buffer, size, "%.3s, %02d %.3s %d %02d:%02d:%02d GMT",
+      kWeekdays + weekday * 3, time.tm_mday, kMonths + time.tm_month * 3,
+      time.tm_year, time.tm_hour, time.tm_min, time.tm_sec);
+  if (length < 0 || static_cast<size_t>(length) >= size)
+    return 0;
+  return static_cast<size_t>(length);
+}
@@ -0,0 +1,25 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DATE_PARSER_H_
+#define DATE_PARSER_H_
+
+#include "prtime.h"
+#include "string_piece.h"
+
+// Decodes a date in the fixed-length RFC 1123 format required by RFC 3261
+// for the Date header, such as "Sun, 06 Nov 1994 08:49:37 GMT", checking and
+// converting each field at its fixed offset in a single pass.
+//
+// Returns false for any other format, including case variations and out of
+// range fields, which are left to PR_ParseTimeStringToExplodedTime().
+bool ParseRFC1123Date(StringPiece input, PRExplodedTime* result);
+
+// Writes |time| in the RFC 1123 format, computing the day of the week and
+// ignoring microseconds and offsets. Returns the length written to |buffer|,
+// or 0 if a field is out of range or |size| is too small.
+size_t FormatRFC1123Date(const PRExplodedTime& time, char* buffer,
+    size_t size);
+
+#endif // DATE_PARSER_H_
@@ -0,0 +1,202 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "framer.h"
+
+#include <algorithm>
+
+#include "header_table.h"
+#include "line_scanner.h"
+#include "utils.h"
+
+namespace {
+
+// Parses a Content-Length value, which must be made of digits only.
+bool ParseContentLength(const std::string& value, size_t* content_length) {
+  StringPiece::const_iterator begin = value.data();
+  StringPiece::const_iterator end = value.data() + value.size();
+  TrimLWS(&begin, &end);
+  // Longer values would overflow, and are too large anyway.
+  if (begin == end || end - begin > 9)
+    return false;
+  size_t result = 0;
+  for (; begin != end; ++begin) {
+    if (*begin < '0' || *begin > '9')
+      return false;
+    result = result * 10 + (*begin - '0');
+  }
+  *content_length = result;
+  return true;
+}
+
+}  // namespace
+
+StreamFramer::StreamFramer(size_t max_message_size)
+  : max_message_size_(max_message_size),
+    status_(FRAMER_OK),
+    scanned_(0),
+    message_length_(0) {
+}
+
+FramerStatus StreamFramer::Feed(const char* chunk, size_t size,
+    FramedChunk* result) {
+  result->buffered_message.clear();
+  result->messages.clear();
+  result->keepalives = 0;
+  if (status_ != FRAMER_OK)
+    return status_;
+
+  size_t offset = 0;
+  if (!pending_.empty()) {
+    // Complete the pending message with as few bytes as possible; the rest
+    // of the chunk is split in place.
+    size_t buffered = pending_.size();
+    size_t appended = size;
+    if (message_length_ != 0)
+      appended = std::min(size, message_length_ - buffered);
+    pending_.append(chunk, appended);
+
+    size_t consumed = 0;
+    while (consumed < buffered) {
+      size_t length;
+      FrameType type = NextFrame(pending_.data() + consumed,
+          pending_.size() - consumed, &length);
+      if (type == FRAME_ERROR) {
+        return status_;
+      } else if (type == FRAME_INCOMPLETE) {
+        pending_.erase(0, consumed);
+        return status_;
+      } else if (type == FRAME_MESSAGE) {
+        result->buffered_message.assign(pending_, consumed, length);
+        scanned_ = 0;
+        message_length_ = 0;
+      } else if (type == FRAME_KEEPALIVE) {
+        ++result->keepalives;
+      }
+      consumed += length;
+    }
+    pending_.clear();
+    offset = consumed - buffered;
+  }
+
+  while (offset < size) {
+    size_t length;
+    FrameType type = NextFrame(chunk + offset, size - offset, &length);
+    if (type == FRAME_ERROR) {
+      return status_;
+    } else if (type == FRAME_INCOMPLETE) {
+      pending_.assign(chunk + offset, size - offset);
+      break;
+    } else if (type == FRAME_MESSAGE) {
+      result->messages.push_back(std::make_pair(offset, length));
+      scanned_ = 0;
+      message_length_ = 0;
+    } else if (type == FRAME_KEEPALIVE) {
+      ++result->keepalives;
+    }
+    offset += length;
+  }
+  return status_;
+}
+
+StreamFramer::FrameType StreamFramer::NextFrame(const char* data, size_t size,
+    size_t* length) {
+  if (message_length_ == 0) {
+    // Line breaks between messages are either keepalives or padding.
+    static const char kKeepalive[] = "\r\n\r\n";
+    if (scanned_ == 0 && (data[0] == '\r' || data[0] == '\n')) {
+      size_t matched = 0;
+      while (matched < std::min<size_t>(size, 4)
+          && data[matched] == kKeepalive[matched])
+        ++matched;
+      if (matched == 4) {
+        *length = 4;
+        return FRAME_KEEPALIVE;
+      } else if (matched == size) {
+        return FRAME_INCOMPLETE;
+      } else if (matched >= 2) {
+        *length = 2;
+        return FRAME_LINE_BREAK;
+      } else if (data[0] == '\n') {
+        *length = 1;
+        return FRAME_LINE_BREAK;
+      }
+    }
+
+    // A line break may have been split by the end of the previous chunk.
+    const char* begin = data + (scanned_ > 3 ? scanned_ - 3 : 0);
+    const char* headers_end;
+    const char* body_begin;
+    if (!FindEmptyLine(begin, data + size, &headers_end, &body_begin)) {
+      scanned_ = size;
+      if (size > max_message_size_) {
+        status_ = FRAMER_MESSAGE_TOO_LARGE;
+        return FRAME_ERROR;
+      }
+      return FRAME_INCOMPLETE;
+    }
+
+    size_t content_length;
+    status_ = GetContentLength(data, headers_end, &content_length);
+    if (status_ != FRAMER_OK)
+      return FRAME_ERROR;
+    size_t headers_length = body_begin - data;
+    if (headers_length + content_length > max_message_size_) {
+      status_ = FRAMER_MESSAGE_TOO_LARGE;
+      return FRAME_ERROR;
+    }
+    message_length_ = headers_length + content_length;
+  }
+
+  if (size < message_length_)
+    return FRAME_INCOMPLETE;
+  *length = message_length_;
+  return FRAME_MESSAGE;
+}
+
+FramerStatus StreamFramer::GetContentLength(const char* begin,
+    const char* end, size_t* content_length) const {
+  bool found = false;
+  bool in_content_length = false;
+  std::string value;
+  // The start line is skipped.
+  const char* line_end = FindLineBreak(begin, end);
+  while (line_end != end || in_content_length) {
+    const char* line = line_end;
+    if (line != end && *line == '\r')
+      ++line;
+    if (line != end && *line == '\n')
+      ++line;
+    line_end = FindLineBreak(line, end);
+    if (line != line_end && IsLWS(*line)) {
+      if (in_content_length)
+        value.append(line, line_end);  // a continuation line
+      continue;
+    }
+
+    if (in_content_length) {
+      size_t length;
+      if (!ParseContentLength(value, &length)
+          || (found && length != *content_length))
+        return FRAMER_INVALID_CONTENT_LENGTH;
+      *content_length = length;
+      found = true;
+      in_content_length = false;
+    }
+
+    const char* colon = std::find(line, line_end, ':');
+    if (colon == line_end)
+      continue;
+    StringPiece::const_iterator name_begin = line;
+    StringPiece::const_iterator name_end = colon;
+    TrimLWS(&name_begin, &name_end);
+    HeaderIndex index;
+    if (LookupHeader(StringPiece(name_begin, name_end), &index)
+        && index == HEADER_content_length) {
+      value.assign(colon + 1, line_end);
+      in_content_length = true;
+    }
+  }
+  return found ? FRAMER_OK : FRAMER_MISSING_CONTENT_LENGTH;
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef FRAMER_H_
+#define FRAMER_H_
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum FramerStatus {
+  FRAMER_OK,
+  FRAMER_MESSAGE_TOO_LARGE,
+  FRAMER_MISSING_CONTENT_LENGTH,
+  FRAMER_INVALID_CONTENT_LENGTH,
+};
+
+// The messages found in a chunk fed to a StreamFramer.
+struct FramedChunk {
+  // A message started by previous chunks and completed by this one. It has
+  // been copied out of the framer buffer, and is empty if there is none.
+  std::string buffered_message;
+
+  // The offset and length of the messages lying entirely within the chunk,
+  // in order, after |buffered_message|.
+  std::vector<std::pair<size_t, size_t>> messages;
+
+  // The number of RFC 5626 keepalive pings (a double CRLF) received between
+  // messages. Each one should be answered with a single CRLF.
+  int keepalives;
+};
+
+// Splits the byte stream of a connection-oriented transport into messages,
+// as described in RFC 3261, section 18.3: each message ends after the empty
+// line closing its header section plus the number of bytes given by its
+// Content-Length header. Bytes of an incomplete message are kept until the
+// following chunks complete it.
+//
+// The header section of an incomplete message is never rescanned: the search
+// for its end resumes where the previous chunk left it.
+class StreamFramer {
+ public:
+  explicit StreamFramer(size_t max_message_size);
+
+  // Splits |chunk|, which follows the chunks fed before. Once an error is
+  // returned the stream cannot be resynchronized, and the same error is
+  // returned for all later chunks.
+  FramerStatus Feed(const char* chunk, size_t size, FramedChunk* result);
+
+ private:
+  enum FrameType {
+    FRAME_INCOMPLETE,
+    FRAME_MESSAGE,
+    FRAME_LINE_BREAK,
+    FRAME_KEEPALIVE,
+    FRAME_ERROR,
+  };
+
+  // Looks for a frame at the start of |data|, setting |*length| to its size.
+  FrameType NextFrame(const char* data, size_t size, size_t* length);
+
+  // Reads the Content-Length of the header section [begin, end).
+  FramerStatus GetContentLength(const char* begin, const char* end,
+      size_t* content_length) const;
+
+  size_t max_message_size_;
+  FramerStatus status_;
+
+  // The bytes of the incomplete message at the end of the previous chunks.
+  std::string pending_;
+
+  // How many bytes of the incomplete message were searched for the end of
+  // its header section, and its full length once that is found.
+  size_t scanned_;
+  size_t message_length_;
+};
+
+#endif // FRAMER_H_
@@ -0,0 +1,159 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "header_table.h"
+
+#include <cstdint>
+
+namespace {
+
+constexpr const char* kHeaderNames[] = {
+#define X(header_name, compact_form, atom_name, format) \
+  #header_name,
+#include "header_list.h"
+#undef X
+};
+
+constexpr char kCompactForms[] = {
+#define X(header_name, compact_form, atom_name, format) \
+  compact_form,
+#include "header_list.h"
+#undef X
+};
+
+static_assert(HEADER_COUNT < 255, "header indexes must fit in a slot");
+
+constexpr bool EqualStrings(const char* a, const char* b) {
+  while (*a != '\0' && *a == *b) {
+    ++a;
+    ++b;
+  }
+  return *a == *b;
+}
+
+// Authentication parameters are separated by commas, so values of these
+// formats cannot share a line.
+constexpr bool IsOnePerLineFormat(const char* format) {
+  return EqualStrings(format, "SchemeAndAuthParams")
+      || EqualStrings(format, "OnlyAuthParams");
+}
+
+constexpr bool kOnePerLine[] = {
+#define X(header_name, compact_form, atom_name, format) \
+  IsOnePerLineFormat(#format),
+#include "header_list.h"
+#undef X
+};
+
+// Header names are compared ignoring case. Underscores are taken as dashes,
+// as header names used to be matched against their atom names.
+constexpr char FoldHeaderChar(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A'))
+       : (c == '_') ? '-'
+       : c;
+}
+
+constexpr size_t Length(const char* s) {
+  size_t n = 0;
+  while (s[n] != '\0')
+    ++n;
+  return n;
+}
+
+// FNV-1a over the folded characters, starting from |seed|.
+constexpr uint32_t HashHeaderName(const char* s, size_t n, uint32_t seed) {
+  uint32_t h = seed;
+  for (size_t i = 0; i < n; ++i) {
+    h ^= static_cast<unsigned char>(FoldHeaderChar(s[i]));
+    h *= 16777619u;
+  }
+  return h;
+}
+
+const size_t kSlotCount = 512;
+
+struct HeaderTable {
+  bool found;
+  uint32_t seed;
+  // Header index plus one, or zero for empty slots.
+  uint8_t slots[kSlotCount];
+  // Same as above, indexed by the lowercase compact form letter.
+  uint8_t compact_forms[26];
+};
+
+// Tries seeds until every full header name hashes to its own slot.
+constexpr HeaderTable BuildHeaderTable() {
+  HeaderTable table = {};
+  for (uint32_t seed = 2166136261u; seed < 2166136261u + 10000; ++seed) {
+    for (size_t i = 0; i < kSlotCount; ++i)
+      table.slots[i] = 0;
+    bool collision = false;
+    for (size_t i = 0; i < HEADER_COUNT && !collision; ++i) {
+      const char* name = kHeaderNames[i];
+      size_t slot = HashHeaderName(name, Length(name), seed) % kSlotCount;
+      if (table.slots[slot] != 0)
+        collision = true;
+      else
+        table.slots[slot] = static_cast<uint8_t>(i + 1);
+    }
+    if (!collision) {
+      table.found = true;
+      table.seed = seed;
+      break;
+    }
+  }
+  for (size_t i = 0; i < HEADER_COUNT; ++i) {
+    char c = FoldHeaderChar(kCompactForms[i]);
+    if (c >= 'a' && c <= 'z')
+      table.compact_forms[c - 'a'] = static_cast<uint8_t>(i + 1);
+  }
+  return table;
+}
+
+constexpr HeaderTable kHeaderTable = BuildHeaderTable();
+
+static_assert(kHeaderTable.found,
+    "no perfect hash seed found, increase kSlotCount");
+
+bool EqualsHeaderName(StringPiece name, const char* header_name) {
+  size_t i = 0;
+  for (; i < name.size(); ++i) {
+    if (header_name[i] == '\0'
+        || FoldHeaderChar(name[i]) != FoldHeaderChar(header_name[i]))
+      return false;
+  }
+  return header_name[i] == '\0';
+}
+
+}  // namespace
+
+bool LookupHeader(StringPiece name, HeaderIndex* index) {
+  uint8_t slot = 0;
+  if (name.size() == 1) {
+    char c = FoldHeaderChar(name[0]);
+    if (c >= 'a' && c <= 'z')
+      slot = kHeaderTable.compact_forms[c - 'a'];
+  } else {
+    slot = kHeaderTable.slots[HashHeaderName(name.data(), name.size(),
+        kHeaderTable.seed) % kSlotCount];
+    if (slot != 0 && !EqualsHeaderName(name, kHeaderNames[slot - 1]))
+      slot = 0;
+  }
+  if (slot == 0)
+    return false;
+  *index = static_cast<HeaderIndex>(slot - 1);
+  return true;
+}
+
+StringPiece HeaderName(HeaderIndex index) {
+  return kHeaderNames[index];
+}
+
+char HeaderCompactForm(HeaderIndex index) {
+  return kCompactForms[index];
+}
+
+bool IsOnePerLineHeader(HeaderIndex index) {
+  return kOnePerLine[index];
+}
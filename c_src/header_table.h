@@ -0,0 +1,37 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef HEADER_TABLE_H_
+#define HEADER_TABLE_H_
+
+#include "string_piece.h"
+
+// Indexes of the headers listed in header_list.h, in the same order.
+enum HeaderIndex {
+#define X(header_name, compact_form, atom_name, format) \
+  HEADER_##atom_name,
+#include "header_list.h"
+#undef X
+  HEADER_COUNT
+};
+
+// Looks up a header by its full or compact name, ignoring case. Returns true
+// and sets |*index| if the header is listed in header_list.h.
+//
+// Full names are resolved through a perfect hash built at compile time, so
+// the lookup does not allocate and costs a single string comparison.
+bool LookupHeader(StringPiece name, HeaderIndex* index);
+
+// The canonical name of a header, such as "Call-ID".
+StringPiece HeaderName(HeaderIndex index);
+
+// The compact form of a header, such as 'i' for Call-ID, or 0 if it has
+// none.
+char HeaderCompactForm(HeaderIndex index);
+
+// Whether the values of a header are written one per line instead of joined
+// by commas, as done for the authentication headers.
+bool IsOnePerLineHeader(HeaderIndex index);
+
+#endif // HEADER_TABLE_H_
@@ -0,0 +1,120 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ip_address.h"
+
+#include <cstring>
+
+namespace {
+
+// Returns the value of the hexadecimal digit |c|, or -1.
+int HexDigitValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+}  // namespace
+
+bool ParseIPv4Address(StringPiece input, uint8_t address[4]) {
+  const char* p = input.data();
+  const char* end = p + input.size();
+  for (int i = 0; i < 4; ++i) {
+    if (i > 0) {
+      if (p == end || *p != '.')
+        return false;
+      ++p;
+    }
+    const char* part_start = p;
+    unsigned value = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+      value = value * 10 + (*p - '0');
+      if (value > 255)
+        return false;
+    }
+    size_t length = p - part_start;
+    if (length == 0 || (length > 1 && *part_start == '0'))
+      return false;
+    address[i] = static_cast<uint8_t>(value);
+  }
+  return p == end;
+}
+
+bool ParseIPv6Address(StringPiece input, uint16_t address[8]) {
+  const char* p = input.data();
+  const char* end = p + input.size();
+  uint16_t groups[8];
+  int count = 0;
+  // The index of the first group after "::", or -1.
+  int compressed = -1;
+
+  if (end - p >= 2 && p[0] == ':' && p[1] == ':') {
+    compressed = 0;
+    p += 2;
+  } else if (p != end && *p == ':') {
+    return false;
+  }
+
+  while (p != end) {
+    if (count == 8)
+      return false;
+    const char* group_start = p;
+    unsigned value = 0;
+    int digit;
+    for (; p != end && p - group_start < 4
+           && (digit = HexDigitValue(*p)) != -1; ++p)
+      value = (value << 4) | digit;
+
+    if (p != end && *p == '.') {
+      // An embedded IPv4 address takes the last two groups.
+      uint8_t ipv4[4];
+      if (count > 6
+          || !ParseIPv4Address(StringPiece(group_start, end), ipv4))
+        return false;
+      groups[count++] = static_cast<uint16_t>((ipv4[0] << 8) | ipv4[1]);
+      groups[count++] = static_cast<uint16_t>((ipv4[2] << 8) | ipv4[3]);
+      p = end;
+      break;
+    }
+    if (p == group_start)
+      return false;
+    groups[count++] = static_cast<uint16_t>(value);
+
+    if (p == end)
+      break;
+    if (*p != ':')
+      return false;
+    ++p;
+    if (p != end && *p == ':') {
+      if (compressed != -1)
+        return false;
+      compressed = count;
+      ++p;
+    } else if (p == end) {
+      return false;
+    }
+  }
+
+  if (compressed == -1) {
+    if (count != 8)
+      return false;
+    memcpy(address, groups, sizeof(groups));
+    return true;
+  }
+  // "::" stands for at least one group of zeros.
+  if (count == 8)
+    return false;
+  int zeros = 8 - count;
+  for (int i = 0; i < compressed; ++i)
+    address[i] = groups[i];
+  for (int i = 0; i < zeros; ++i)
+    address[compressed + i] = 0;
+  for (int i = compressed; i < count; ++i)
+    address[zeros + i] = groups[i];
+  return true;
+}
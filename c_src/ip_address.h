@@ -0,0 +1,23 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IP_ADDRESS_H_
+#define IP_ADDRESS_H_
+
+#include <cstdint>
+
+#include "string_piece.h"
+
+// Parses a dotted-decimal IPv4 address, such as "192.0.2.1", into its four
+// bytes. As inet_pton(), exactly four decimal parts are required, without
+// leading zeros, so that hostnames made of digits are not mistaken for
+// addresses.
+bool ParseIPv4Address(StringPiece input, uint8_t address[4]);
+
+// Parses an IPv6 address in the textual form of RFC 4291, section 2.2, such
+// as "2001:db8::1" or "::ffff:192.0.2.1", into its eight 16-bit groups. The
+// input must not be bracketed.
+bool ParseIPv6Address(StringPiece input, uint16_t address[8]);
+
+#endif // IP_ADDRESS_H_
@@ -0,0 +1,101 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "line_scanner.h"
+
+#include "build_config.h"
+
+#if defined(ARCH_CPU_X86_FAMILY) && defined(COMPILER_GCC)
+#include <immintrin.h>
+#define LINE_SCANNER_AVX2 1
+#endif
+
+namespace {
+
+typedef const char* (*FindLineBreakFunction)(const char*, const char*);
+
+const char* FindLineBreakScalar(const char* p, const char* end) {
+  for (; p != end; ++p) {
+    if (*p == '\r' || *p == '\n')
+      break;
+  }
+  return p;
+}
+
+#if defined(__SSE2__)
+const char* FindLineBreakSSE2(const char* p, const char* end) {
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  for (; end - p >= 16; p += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int mask = _mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(block, cr), _mm_cmpeq_epi8(block, lf)));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+  return FindLineBreakScalar(p, end);
+}
+#endif
+
+#if defined(LINE_SCANNER_AVX2)
+__attribute__((target("avx2")))
+const char* FindLineBreakAVX2(const char* p, const char* end) {
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  for (; end - p >= 32; p += 32) {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, cr),
+                        _mm256_cmpeq_epi8(block, lf))));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+  return FindLineBreakScalar(p, end);
+}
+#endif
+
+FindLineBreakFunction SelectFindLineBreak() {
+#if defined(LINE_SCANNER_AVX2)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return &FindLineBreakAVX2;
+#endif
+#if defined(__SSE2__)
+  return &FindLineBreakSSE2;
+#else
+  return &FindLineBreakScalar;
+#endif
+}
+
+// Chosen once, when the NIF library is loaded.
+const FindLineBreakFunction g_find_line_break = SelectFindLineBreak();
+
+}  // namespace
+
+const char* FindLineBreak(const char* begin, const char* end) {
+  return g_find_line_break(begin, end);
+}
+
+bool FindEmptyLine(const char* begin, const char* end,
+    const char** headers_end, const char** body_begin) {
+  for (const char* p = FindLineBreak(begin, end); p != end;
+       p = FindLineBreak(p, end)) {
+    const char* line_break = p;
+    if (*p++ == '\r') {
+      if (p == end || *p != '\n')
+        continue;  // not a line break
+      ++p;
+    }
+    if (p != end && *p == '\r' && p + 1 != end && *(p + 1) == '\n')
+      p += 2;
+    else if (p != end && *p == '\n')
+      ++p;
+    else
+      continue;
+    *headers_end = line_break;
+    *body_begin = p;
+    return true;
+  }
+  return false;
+}
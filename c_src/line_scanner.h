@@ -0,0 +1,21 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LINE_SCANNER_H_
+#define LINE_SCANNER_H_
+
+// Returns a pointer to the first CR or LF in [begin, end), or |end| if there
+// is none.
+//
+// On x86 the input is scanned in 16 or 32-byte blocks, using AVX2 when the
+// CPU supports it and SSE2 otherwise. Other architectures use a plain loop.
+const char* FindLineBreak(const char* begin, const char* end);
+
+// Looks for the empty line ending a header section in [begin, end), taking
+// CRLF or LF as line breaks. Returns true and sets |*headers_end| to the line
+// break preceding it and |*body_begin| past it, if there is one.
+bool FindEmptyLine(const char* begin, const char* end,
+    const char** headers_end, const char** body_begin);
+
+#endif // LINE_SCANNER_H_
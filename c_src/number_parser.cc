@@ -0,0 +1,212 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "number_parser.h"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <locale>
+#include <sstream>
+#include <string>
+
+#include "build_config.h"
+
+#if !defined(ARCH_CPU_LITTLE_ENDIAN)
+#error The digit words below assume a little-endian CPU
+#endif
+
+namespace {
+
+const uint64_t kZeroDigits = 0x3030303030303030ULL;
+
+// Loads up to 8 characters into a word, the last one in the most significant
+// byte, padding the least significant bytes with '0' so that the padding does
+// not change the value.
+uint64_t LoadDigits(const char* p, size_t n) {
+  char buffer[8];
+  memset(buffer, '0', sizeof(buffer));
+  memcpy(buffer + sizeof(buffer) - n, p, n);
+  uint64_t word;
+  memcpy(&word, buffer, sizeof(word));
+  return word;
+}
+
+// Whether all the bytes of |word| are ASCII digits: their high nibble must be
+// 3, and must remain 3 after adding 6 to the byte.
+bool AllDigits(uint64_t word) {
+  const uint64_t kHighNibbles = 0xf0f0f0f0f0f0f0f0ULL;
+  return ((word & kHighNibbles)
+      | (((word + 0x0606060606060606ULL) & kHighNibbles) >> 4))
+      == 0x3333333333333333ULL;
+}
+
+// Converts the 8 digits of |word|, the first one in the least significant
+// byte, by combining pairs of digits, then pairs of pairs, and so on.
+uint32_t DigitsValue(uint64_t word) {
+  const uint64_t kMask = 0x000000ff000000ffULL;
+  const uint64_t kMul1 = 100 + (1000000ULL << 32);
+  const uint64_t kMul2 = 1 + (10000ULL << 32);
+  word -= kZeroDigits;
+  word = (word * 10) + (word >> 8);
+  word = (((word & kMask) * kMul1) + (((word >> 16) & kMask) * kMul2)) >> 32;
+  return static_cast<uint32_t>(word);
+}
+
+// Converts up to 16 digits. Returns false if any of them is not a digit.
+bool ParseDigits(const char* p, size_t n, uint64_t* value) {
+  if (n <= 8) {
+    uint64_t word = LoadDigits(p, n);
+    if (!AllDigits(word))
+      return false;
+    *value = DigitsValue(word);
+    return true;
+  }
+  size_t high_length = n - 8;
+  uint64_t high = LoadDigits(p, high_length);
+  uint64_t low = LoadDigits(p + high_length, 8);
+  if (!AllDigits(high) || !AllDigits(low))
+    return false;
+  *value = DigitsValue(high) * 100000000ULL + DigitsValue(low);
+  return true;
+}
+
+// The powers of ten that are exactly representable as doubles.
+const double kExactPowersOfTen[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+const int kMaxExactPowerOfTen = 22;
+
+// The largest integer below which all integers are exactly representable.
+const uint64_t kMaxExactInteger = 1ULL << 53;
+
+// Significant digits beyond this could overflow the mantissa.
+const int kMaxMantissaDigits = 19;
+
+bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Converts numbers that cannot be converted exactly by ParseDecimalDouble(),
+// with the rounding of the standard library, and regardless of the global
+// locale.
+bool ParseDoubleSlow(StringPiece input, double* output) {
+  std::istringstream stream(input.as_string());
+  stream.imbue(std::locale::classic());
+  stream >> *output;
+  return !stream.fail();
+}
+
+}  // namespace
+
+bool ParseDecimalInt(StringPiece input, int* output) {
+  const char* p = input.data();
+  size_t n = input.size();
+  bool negative = false;
+  if (n != 0 && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+    --n;
+  }
+  while (n > 1 && *p == '0') {
+    ++p;
+    --n;
+  }
+  // An int has at most 10 digits.
+  uint64_t value;
+  if (n == 0 || n > 10 || !ParseDigits(p, n, &value))
+    return false;
+
+  uint64_t limit = std::numeric_limits<int>::max();
+  if (negative)
+    ++limit;
+  if (value > limit)
+    return false;
+  *output = negative ? static_cast<int>(-static_cast<int64_t>(value))
+                     : static_cast<int>(value);
+  return true;
+}
+
+bool ParseDecimalDouble(StringPiece input, double* output) {
+  const char* p = input.data();
+  const char* end = p + input.size();
+  bool negative = false;
+  if (p != end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+
+  // Leading zeros are skipped; the digits beyond the capacity of the
+  // mantissa make the conversion inexact.
+  uint64_t mantissa = 0;
+  int mantissa_digits = 0;
+  int exponent = 0;
+  bool has_digits = false;
+  bool truncated = false;
+  for (; p != end && IsDigit(*p); ++p) {
+    has_digits = true;
+    if (mantissa_digits < kMaxMantissaDigits) {
+      mantissa = mantissa * 10 + (*p - '0');
+      mantissa_digits += mantissa != 0;
+    } else {
+      ++exponent;
+      truncated = true;
+    }
+  }
+  if (p != end && *p == '.') {
+    for (++p; p != end && IsDigit(*p); ++p) {
+      has_digits = true;
+      if (mantissa_digits < kMaxMantissaDigits) {
+        mantissa = mantissa * 10 + (*p - '0');
+        mantissa_digits += mantissa != 0;
+        --exponent;
+      } else {
+        truncated = true;
+      }
+    }
+  }
+  if (!has_digits)
+    return false;
+
+  if (p != end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    bool negative_exponent = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+      negative_exponent = *p == '-';
+      ++p;
+    }
+    if (p == end || !IsDigit(*p))
+      return false;
+    int explicit_exponent = 0;
+    for (; p != end && IsDigit(*p); ++p) {
+      // Larger exponents overflow or underflow anyway.
+      if (explicit_exponent < 100000)
+        explicit_exponent = explicit_exponent * 10 + (*p - '0');
+    }
+    exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+  }
+  if (p != end)
+    return false;
+
+  if (mantissa == 0) {
+    *output = negative ? -0.0 : 0.0;
+    return true;
+  }
+  // Both the mantissa and the power of ten are exact, so the result of the
+  // single multiplication or division is correctly rounded.
+  if (!truncated && mantissa <= kMaxExactInteger
+      && exponent >= -kMaxExactPowerOfTen
+      && exponent <= kMaxExactPowerOfTen) {
+    double value = static_cast<double>(mantissa);
+    if (exponent < 0)
+      value /= kExactPowersOfTen[-exponent];
+    else
+      value *= kExactPowersOfTen[exponent];
+    *output = negative ? -value : value;
+    return true;
+  }
+  return ParseDoubleSlow(input, output);
+}
@@ -0,0 +1,28 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef NUMBER_PARSER_H_
+#define NUMBER_PARSER_H_
+
+#include "string_piece.h"
+
+// Parses a decimal integer: an optional sign followed by digits, with no
+// surrounding whitespace. Returns false if |input| is not such a number, or
+// if it does not fit in an int.
+//
+// The digits are validated and converted eight at a time within a 64-bit
+// word, so any value that fits in an int takes at most two steps.
+bool ParseDecimalInt(StringPiece input, int* output);
+
+// Parses a decimal number with an optional sign, fraction and exponent,
+// such as the values of the Timestamp header. Unlike strtod(), the decimal
+// point is always '.', whatever the C locale. Returns false if |input| is
+// not such a number, including when there are trailing characters.
+//
+// Numbers with up to 15 significant digits and a small exponent, which
+// covers all practical values, are converted exactly with a single
+// floating-point operation.
+bool ParseDecimalDouble(StringPiece input, double* output);
+
+#endif // NUMBER_PARSER_H_
@@ -9,24 +9,411 @@
 
 #include <erl_nif.h>
 
+#include <algorithm>
+#include <atomic>
+#include <bitset>
 #include <cstring>
-#include <unordered_map>
 #include <iostream>
-
+#include <limits>
+#include <locale>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.h"
+#include "char_class.h"
+#include "date_parser.h"
+#include "framer.h"
+#include "header_table.h"
+#include "ip_address.h"
+#include "line_scanner.h"
+#include "number_parser.h"
 #include "prtime.h"
 #include "string_piece.h"
 #include "tokenizer.h"
 #include "string_tokenizer.h"
+#include "uri_compare.h"
+#include "uri_parser.h"
 #include "utils.h"
 
 namespace {
 
 typedef ERL_NIF_TERM (*ParseFunction)(ErlNifEnv* env,
-                                      std::string::const_iterator,
-                                      std::string::const_iterator);
+                                      StringPiece::const_iterator,
+                                      StringPiece::const_iterator);
+
+// Indexes of the atoms listed in atom_list.h.
+enum AtomIndex {
+#define SIP_ATOM(x) ATOM_##x,
+#include "atom_list.h"
+#undef SIP_ATOM
+  ATOM_COUNT
+};
+
+// Indexes of the methods listed in method_list.h.
+enum MethodIndex {
+#define SIP_METHOD(x) METHOD_##x,
+#include "method_list.h"
+#undef SIP_METHOD
+  METHOD_COUNT
+};
+
+// Indexes of the protocols listed in protocol_list.h.
+enum ProtocolIndex {
+#define SIP_PROTOCOL(x) PROTOCOL_##x,
+#include "protocol_list.h"
+#undef SIP_PROTOCOL
+  PROTOCOL_COUNT
+};
+
+const char* const kMethodNames[] = {
+#define SIP_METHOD(x) #x,
+#include "method_list.h"
+#undef SIP_METHOD
+};
+
+const char* const kProtocolNames[] = {
+#define SIP_PROTOCOL(x) #x,
+#include "protocol_list.h"
+#undef SIP_PROTOCOL
+};
+
+// Terms created when the library is loaded. Atoms are never garbage
+// collected, so they can be reused by every call.
+struct PrivData {
+  ERL_NIF_TERM atoms[ATOM_COUNT];
+  ERL_NIF_TERM method_atoms[METHOD_COUNT];
+  ERL_NIF_TERM protocol_atoms[PROTOCOL_COUNT];
+  ERL_NIF_TERM header_atoms[HEADER_COUNT];
+  ErlNifResourceType* lazy_message_type;
+  ErlNifResourceType* framer_type;
+};
+
+// The private data of the loaded library, also returned by enif_priv_data().
+// It is always read from here instead: terms are also built in process
+// independent environments, such as the ones of lazy messages, where
+// enif_priv_data() cannot be called.
+const PrivData* g_priv = nullptr;
+
+inline ERL_NIF_TERM MakeAtom(AtomIndex index) {
+  return g_priv->atoms[index];
+}
+
+// Counters reported by stats/0. Only the slow paths are counted, so that the
+// common case does not contend on them.
+std::atomic<uint64_t> g_folded_count(0);
+std::atomic<uint64_t> g_date_fallback_count(0);
+
+// Controls how string values are returned to the caller. By default every
+// value is copied into a fresh binary. When |sub_binaries| is set, values
+// taken verbatim from the input are returned as sub-binaries of it instead.
+struct ParseOptions {
+  ParseOptions()
+    : sub_binaries(false),
+      min_sub_binary_size(64),
+      max_pinned_size(65535),
+      only_selected_headers(false),
+      datagram(false),
+      inet_addresses(false),
+      uris(false),
+      raw_headers(false) {
+  }
+
+  // Whether the header should be parsed; |index| is HEADER_COUNT for headers
+  // not listed in header_list.h.
+  bool IsSelected(HeaderIndex index) const {
+    return !only_selected_headers
+        || (index != HEADER_COUNT && selected_headers[index]);
+  }
+
+  bool sub_binaries;
+
+  // Values shorter than this are copied anyway: they end up on the process
+  // heap and never keep the input binary alive.
+  size_t min_sub_binary_size;
+
+  // Inputs larger than this are never referenced by sub-binaries, so that a
+  // small long-lived value cannot pin a large packet.
+  size_t max_pinned_size;
+
+  // When set, headers not in |selected_headers| are skipped entirely.
+  bool only_selected_headers;
+  std::bitset<HEADER_COUNT> selected_headers;
+
+  // Whether the message was received over a datagram transport. The body is
+  // then truncated to the Content-Length, and a body shorter than it is an
+  // error (RFC 3261, section 18.3).
+  bool datagram;
+
+  // Whether numeric Via sent-by hosts are returned as inet address tuples
+  // instead of binaries.
+  bool inet_addresses;
+
+  // Whether SIP, SIPS and TEL URIs are returned decomposed into maps instead
+  // of binaries.
+  bool uris;
+
+  // Whether the original lines of each header are returned along with its
+  // value, so that serialize/1 can copy them if the value is not changed.
+  // The lines are copied, or referenced as values are when |sub_binaries|
+  // is set.
+  bool raw_headers;
+};
+
+// Messages larger than this are parsed on a dirty CPU scheduler, as they may
+// take longer than a timeslice (1 ms) to parse. Smaller messages are parsed
+// on a normal scheduler, reporting a share of the timeslice proportional to
+// their size.
+const size_t kMaxNormalSchedulerSize = 16 * 1024;
+
+// The delimiters of the values scanned by the header parsers.
+constexpr CharClass kLWSOrSlash = kLWSChars | CharClass("/");
+constexpr CharClass kLWSOrSemicolon = kLWSChars | CharClass(";");
+constexpr CharClass kDeltaSecondsEnd = kLWSChars | CharClass("(;");
+
+// A run of bytes of the input binary copied verbatim to another buffer.
+struct InputSegment {
+  size_t assembled_offset;
+  size_t input_offset;
+  size_t length;
+};
+
+// Stands for no line in the chains of ParsedHeader lines.
+const size_t kNoLine = static_cast<size_t>(-1);
+
+// A header line parsed by Parse(). The lines of the same header are chained
+// in order of appearance, so that their values are joined only once.
+struct ParsedHeader {
+  HeaderIndex index;
+  ERL_NIF_TERM name;
+  ERL_NIF_TERM values;
+  // The line in the parsed text, from the name to the end of the values.
+  StringPiece raw_line;
+  // The next line of the same header, and in the first line, the last one.
+  size_t next;
+  size_t last;
+  bool first;
+};
+
+// Hashes the bytes of a StringPiece, with FNV-1a.
+struct StringPieceHash {
+  size_t operator()(StringPiece s) const {
+    uint32_t h = 2166136261u;
+    for (char c : s) {
+      h ^= static_cast<unsigned char>(c);
+      h *= 16777619u;
+    }
+    return h;
+  }
+};
+
+// Buffers kept between calls to Parse(), so that the messages of a batch
+// reuse the memory allocated for the previous ones.
+struct ParseScratch {
+  std::string assembled;
+  std::vector<InputSegment> segments;
+  std::vector<ParsedHeader> headers;
+  std::vector<ERL_NIF_TERM> terms;
+  // The first line of each header not listed in header_list.h, by its name
+  // as written, which is its key in the headers map.
+  std::unordered_map<StringPiece, size_t, StringPieceHash> unknown_headers;
+};
+
+// The binary being parsed. When the input has line continuations,
+// AssembleRawHeaders() copies it into a new buffer while joining them, so
+// each run of bytes copied verbatim is recorded as a segment, allowing ranges
+// of the assembled buffer to be mapped back to offsets of the original binary.
+// Otherwise the input is parsed in place, as a single segment.
+class InputBinary {
+ public:
+  InputBinary(ERL_NIF_TERM term, size_t size, const ParseOptions& options,
+      std::vector<InputSegment>* segments)
+    : term_(term), size_(size), options_(options),
+      assembled_(nullptr), segments_(*segments) {
+    segments_.clear();
+  }
+
+  const ParseOptions& options() const { return options_; }
+
+  void set_assembled(const char* assembled) { assembled_ = assembled; }
+
+  void AddSegment(size_t assembled_offset, size_t input_offset,
+      size_t length) {
+    segments_.push_back(InputSegment{assembled_offset, input_offset, length});
+  }
+
+  // Returns true and sets |*term| to a sub-binary of the input if |s| lies
+  // entirely within a verbatim copied range and the options allow it.
+  bool MakeSubBinary(ErlNifEnv* env, StringPiece s, ERL_NIF_TERM* term) const {
+    if (!MayReference(s.size())
+        || assembled_ == nullptr
+        || s.data() < assembled_)
+      return false;
+    size_t offset = static_cast<size_t>(s.data() - assembled_);
+    auto it = std::upper_bound(segments_.begin(), segments_.end(), offset,
+        [](size_t offset, const InputSegment& segment) {
+          return offset < segment.assembled_offset;
+        });
+    if (it == segments_.begin())
+      return false;
+    --it;
+    if (offset + s.size() > it->assembled_offset + it->length)
+      return false;
+    *term = enif_make_sub_binary(env, term_,
+        it->input_offset + (offset - it->assembled_offset), s.size());
+    return true;
+  }
+
+  // Returns the bytes of the input spanning |line| of the parsed text,
+  // continuation lines included. They are a sub-binary of the input if the
+  // options allow it, or a copy otherwise.
+  ERL_NIF_TERM MakeRawLine(ErlNifEnv* env, StringPiece line) const {
+    size_t begin = InputOffset(line.data());
+    size_t end = InputOffset(line.data() + line.size() - 1) + 1;
+    if (MayReference(end - begin))
+      return enif_make_sub_binary(env, term_, begin, end - begin);
+    ErlNifBinary bin;
+    enif_inspect_binary(env, term_, &bin);
+    ERL_NIF_TERM term;
+    unsigned char* data = enif_make_new_binary(env, end - begin, &term);
+    memcpy(data, bin.data + begin, end - begin);
+    return term;
+  }
+
+  // Maps a byte of the parsed text to its offset in the input. A line break
+  // added when joining continuation lines maps to the one that ended the
+  // previous line in the input, and the end of the text to the end of the
+  // parsed input.
+  size_t InputOffset(const char* p) const {
+    size_t offset = static_cast<size_t>(p - assembled_);
+    auto it = std::upper_bound(segments_.begin(), segments_.end(), offset,
+        [](size_t offset, const InputSegment& segment) {
+          return offset < segment.assembled_offset;
+        });
+    --it;
+    return it->input_offset + (offset - it->assembled_offset);
+  }
+
+ private:
+  // Whether |length| bytes of the input may be returned as a sub-binary.
+  bool MayReference(size_t length) const {
+    return options_.sub_binaries
+        && length != 0
+        && length >= options_.min_sub_binary_size
+        && size_ <= options_.max_pinned_size;
+  }
+
+  ERL_NIF_TERM term_;
+  size_t size_;
+  const ParseOptions& options_;
+  const char* assembled_;
+  std::vector<InputSegment>& segments_;
+};
+
+// The input binary of the message being parsed on this thread, if any.
+thread_local const InputBinary* g_input = nullptr;
+
+class ScopedInputBinary {
+ public:
+  explicit ScopedInputBinary(const InputBinary* input) {
+    g_input = input;
+  }
+  ~ScopedInputBinary() {
+    g_input = nullptr;
+  }
+};
+
+// Collects the keys and values of a map, which is then built at once with
+// enif_make_map_from_arrays(), instead of copying the map on every put.
+// Putting a key already collected replaces its value, as enif_make_map_put()
+// would. Small maps are kept on the stack.
+class MapBuilder {
+ public:
+  explicit MapBuilder(ErlNifEnv* env)
+    : env_(env), size_(0) {
+  }
+
+  // Keys are not looked up here, which would take quadratic time for large
+  // maps; the rare duplicates are removed by Build().
+  void Put(ERL_NIF_TERM key, ERL_NIF_TERM value) {
+    if (size_ < kInlineCapacity) {
+      inline_keys_[size_] = key;
+      inline_values_[size_] = value;
+    } else {
+      if (size_ == kInlineCapacity) {
+        keys_.assign(inline_keys_, inline_keys_ + size_);
+        values_.assign(inline_values_, inline_values_ + size_);
+      }
+      keys_.push_back(key);
+      values_.push_back(value);
+    }
+    ++size_;
+  }
+
+  ERL_NIF_TERM Build() {
+    ERL_NIF_TERM map;
+    if (enif_make_map_from_arrays(env_, keys(), values(), size_, &map))
+      return map;
+    // Some key was put more than once.
+    std::vector<ERL_NIF_TERM> keys, values;
+    RemoveDuplicates(&keys, &values);
+    if (!enif_make_map_from_arrays(env_, keys.data(), values.data(),
+            keys.size(), &map))
+      return enif_make_new_map(env_);  // not reached, keys are unique
+    return map;
+  }
+
+ private:
+  static const size_t kInlineCapacity = 16;
+
+  // Sets |*keys| and |*values| to the pairs put, keeping only the last value
+  // put for each key. The pairs are sorted by key, and the sort is stable,
+  // so the last pair of each run of equal keys is the last one put.
+  void RemoveDuplicates(std::vector<ERL_NIF_TERM>* keys,
+      std::vector<ERL_NIF_TERM>* values) const {
+    const ERL_NIF_TERM* all_keys = this->keys();
+    const ERL_NIF_TERM* all_values = this->values();
+    std::vector<size_t> order(size_);
+    for (size_t i = 0; i < size_; ++i)
+      order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+        [all_keys](size_t a, size_t b) {
+          return enif_compare(all_keys[a], all_keys[b]) < 0;
+        });
+    keys->reserve(size_);
+    values->reserve(size_);
+    for (size_t i = 0; i < size_; ++i) {
+      if (i + 1 < size_
+          && enif_compare(all_keys[order[i]], all_keys[order[i + 1]]) == 0)
+        continue;
+      keys->push_back(all_keys[order[i]]);
+      values->push_back(all_values[order[i]]);
+    }
+  }
+
+  ERL_NIF_TERM* keys() {
+    return size_ <= kInlineCapacity ? inline_keys_ : keys_.data();
+  }
+  const ERL_NIF_TERM* keys() const {
+    return size_ <= kInlineCapacity ? inline_keys_ : keys_.data();
+  }
+  ERL_NIF_TERM* values() {
+    return size_ <= kInlineCapacity ? inline_values_ : values_.data();
+  }
+  const ERL_NIF_TERM* values() const {
+    return size_ <= kInlineCapacity ? inline_values_ : values_.data();
+  }
 
-std::unordered_map<char, ERL_NIF_TERM> g_aliases;
-std::unordered_map<ERL_NIF_TERM, ParseFunction> g_parsers;
+  ErlNifEnv* env_;
+  size_t size_;
+  ERL_NIF_TERM inline_keys_[kInlineCapacity];
+  ERL_NIF_TERM inline_values_[kInlineCapacity];
+  std::vector<ERL_NIF_TERM> keys_;
+  std::vector<ERL_NIF_TERM> values_;
+};
 
 bool MakeExistingAtom(ErlNifEnv* env, StringPiece atom_name,
     ERL_NIF_TERM *atom) {
@@ -36,29 +423,48 @@ bool MakeExistingAtom(ErlNifEnv* env, StringPiece atom_name,
 
 bool MakeLowerCaseExistingAtom(ErlNifEnv* env, StringPiece name,
     ERL_NIF_TERM *atom) {
-  std::string atom_name(name.as_string());
+  ArenaString atom_name(name.data(), name.size());
   for (auto& c : atom_name) {
     if (c == '-')
       c = '_';
     else
       c = ToLowerASCII(c);
   }
-  return MakeExistingAtom(env, atom_name, atom);
+  return MakeExistingAtom(env, StringPiece(atom_name.data(), atom_name.size()),
+      atom);
 }
 
 ERL_NIF_TERM MakeString(ErlNifEnv* env, StringPiece s) {
+  ERL_NIF_TERM term;
+  if (g_input != nullptr && g_input->MakeSubBinary(env, s, &term))
+    return term;
   ErlNifBinary bin;
   if (!enif_alloc_binary(s.size(), &bin))
-    return enif_make_atom(env, "no_memory");
-  memcpy(bin.data, s.data(), s.size());
+    return MakeAtom(ATOM_no_memory);
+  if (!s.empty())
+    memcpy(bin.data, s.data(), s.size());
   return enif_make_binary(env, &bin);
 }
 
+ERL_NIF_TERM MakeArenaString(ErlNifEnv* env, const ArenaString& s) {
+  return MakeString(env, StringPiece(s.data(), s.size()));
+}
+
+// Unquotes the value if it is a quoted-string, otherwise the value is taken
+// as is from the input.
+ERL_NIF_TERM MakeUnquotedString(ErlNifEnv* env,
+    StringPiece::const_iterator begin,
+    StringPiece::const_iterator end) {
+  if (begin != end && IsQuote(*begin))
+    return MakeArenaString(env, Unquote(begin, end));
+  return MakeString(env, StringPiece(begin, end));
+}
+
 ERL_NIF_TERM MakeLowerCaseString(ErlNifEnv* env, StringPiece s) {
-  std::string lowercase(s.as_string());
+  ArenaString lowercase(s.data(), s.size());
   for (auto& c : lowercase)
     c = ToLowerASCII(c);
-  return MakeString(env, lowercase);
+  return MakeArenaString(env, lowercase);
 }
 
 ERL_NIF_TERM MakeLowerCaseExistingAtomOrString(ErlNifEnv* env, StringPiece name) {
@@ -68,53 +474,150 @@ ERL_NIF_TERM MakeLowerCaseExistingAtomOrString(ErlNifEnv* env, StringPiece name)
   return result;
 }
 
+bool EqualsIgnoringCase(StringPiece s, const char* name) {
+  size_t i = 0;
+  for (; i < s.size(); ++i) {
+    if (name[i] == '\0' || ToLowerASCII(s[i]) != ToLowerASCII(name[i]))
+      return false;
+  }
+  return name[i] == '\0';
+}
+
+// Returns the atom loaded for |name| if it is one of the |count| |names|,
+// ignoring case. Other names are looked up in the atom table, as before.
+ERL_NIF_TERM MakeListedAtomOrString(ErlNifEnv* env, StringPiece name,
+    const char* const names[], const ERL_NIF_TERM atoms[], size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (EqualsIgnoringCase(name, names[i]))
+      return atoms[i];
+  }
+  return MakeLowerCaseExistingAtomOrString(env, name);
+}
+
+ERL_NIF_TERM MakeMethod(ErlNifEnv* env, StringPiece name) {
+  return MakeListedAtomOrString(env, name, kMethodNames,
+      g_priv->method_atoms, METHOD_COUNT);
+}
+
+ERL_NIF_TERM MakeProtocol(ErlNifEnv* env, StringPiece name) {
+  return MakeListedAtomOrString(env, name, kProtocolNames,
+      g_priv->protocol_atoms, PROTOCOL_COUNT);
+}
+
+// Makes a binary of a URI component validated by ParseSipUri(), decoding its
+// escapes, if any.
+ERL_NIF_TERM MakeUriComponent(ErlNifEnv* env, StringPiece s, bool lowercase) {
+  ArenaString unescaped;
+  if (s.find('%') != StringPiece::npos) {
+    unescaped = UnescapeUri(s);
+    s = StringPiece(unescaped.data(), unescaped.size());
+  }
+  return lowercase ? MakeLowerCaseString(env, s) : MakeString(env, s);
+}
+
+// Makes a map of the name=value pairs of the parameters or headers of a URI.
+// As in ParseParameters(), parameters without a value map to "".
+ERL_NIF_TERM MakeUriPairs(ErlNifEnv* env, StringPiece input,
+    const char* delimiter, bool lowercase_names) {
+  MapBuilder result(env);
+  CStringTokenizer pairs(input.begin(), input.end(), delimiter);
+  while (pairs.GetNext()) {
+    StringPiece pair(pairs.token_begin(), pairs.token_end());
+    size_t equals = pair.find('=');
+    StringPiece value;
+    if (equals != StringPiece::npos)
+      value = pair.substr(equals + 1);
+    result.Put(MakeUriComponent(env, pair.substr(0, equals), lowercase_names),
+        MakeUriComponent(env, value, false));
+  }
+  return result.Build();
+}
+
+// Makes the map of a SIP, SIPS or TEL URI, or returns ATOM_invalid_uri if it
+// is malformed. The URIs of other schemes, which some headers carry, are
+// returned as binaries.
+ERL_NIF_TERM MakeUri(ErlNifEnv* env, StringPiece input) {
+  if (!HasSipUriScheme(input))
+    return MakeString(env, input);
+  SipUri uri;
+  if (!ParseSipUri(input, &uri))
+    return MakeAtom(ATOM_invalid_uri);
+  ERL_NIF_TERM nil = MakeAtom(ATOM_nil);
+  ERL_NIF_TERM keys[] = {
+    MakeAtom(ATOM_scheme),
+    MakeAtom(ATOM_user),
+    MakeAtom(ATOM_password),
+    MakeAtom(ATOM_host),
+    MakeAtom(ATOM_port),
+    MakeAtom(ATOM_parameters),
+    MakeAtom(ATOM_headers),
+  };
+  ERL_NIF_TERM values[] = {
+    MakeLowerCaseString(env, uri.scheme),
+    uri.has_user ? MakeUriComponent(env, uri.user, false) : nil,
+    uri.has_password ? MakeUriComponent(env, uri.password, false) : nil,
+    uri.host.empty() ? nil : MakeString(env, uri.host),
+    uri.port == -1 ? nil : enif_make_int(env, uri.port),
+    MakeUriPairs(env, uri.parameters, ";", true),
+    MakeUriPairs(env, uri.headers, "&", false),
+  };
+  ERL_NIF_TERM result;
+  enif_make_map_from_arrays(env, keys, values, 7, &result);
+  return result;
+}
+
+// Makes the term of a URI found in the message being parsed: a map if the
+// |uris| option is set, a binary otherwise.
+ERL_NIF_TERM MakeMessageUri(ErlNifEnv* env, StringPiece input) {
+  if (g_input == nullptr || !g_input->options().uris)
+    return MakeString(env, input);
+  return MakeUri(env, input);
+}
+
 bool IsStatusLine(
-      std::string::const_iterator line_begin,
-      std::string::const_iterator line_end) {
+      StringPiece::const_iterator line_begin,
+      StringPiece::const_iterator line_end) {
   return ((line_end - line_begin > 4)
       && LowerCaseEqualsASCII(
              StringPiece(line_begin, line_begin + 4), "sip/"));
 }
 
-std::string::const_iterator FindLineEnd(
-    std::string::const_iterator begin,
-    std::string::const_iterator end) {
-  size_t i = StringPiece(begin, end).find_first_of("\r\n");
-  if (i == StringPiece::npos)
-    return end;
-  return begin + i;
+StringPiece::const_iterator FindLineEnd(
+    StringPiece::const_iterator begin,
+    StringPiece::const_iterator end) {
+  return FindLineBreak(begin, end);
 }
 
 ERL_NIF_TERM ParseVersion(ErlNifEnv* env,
-    std::string::const_iterator line_begin,
-    std::string::const_iterator line_end) {
+    StringPiece::const_iterator line_begin,
+    StringPiece::const_iterator line_end) {
   Tokenizer tok(line_begin, line_end);
 
   if ((line_end - line_begin < 3) ||
       !LowerCaseEqualsASCII(
           StringPiece(line_begin, line_begin + 3), "sip")) {
-    return enif_make_atom(env, "missing_version_spec");
+    return MakeAtom(ATOM_missing_version_spec);
   }
 
   tok.Skip(3);
-  tok.Skip(SIP_LWS);
+  tok.Skip(kLWSChars);
 
   if (tok.EndOfInput()
       || *tok.current() != '/') {
-    return enif_make_atom(env, "missing_version");
+    return MakeAtom(ATOM_missing_version);
   }
 
   tok.Skip();
-  std::string::const_iterator major_start = tok.Skip(SIP_LWS);
+  StringPiece::const_iterator major_start = tok.Skip(kLWSChars);
   tok.SkipTo('.');
   tok.Skip();
-  std::string::const_iterator minor_start = tok.Skip(SIP_LWS);
+  StringPiece::const_iterator minor_start = tok.Skip(kLWSChars);
   if (tok.EndOfInput()) {
-    return enif_make_atom(env, "malformed_version");
+    return MakeAtom(ATOM_malformed_version);
   }
 
   if (!isdigit(*major_start) || !isdigit(*minor_start)) {
-    return enif_make_atom(env, "malformed_version_number");
+    return MakeAtom(ATOM_malformed_version_number);
   }
 
   int major = *major_start - '0';
@@ -125,62 +628,67 @@ ERL_NIF_TERM ParseVersion(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseStatusLine(ErlNifEnv* env,
-    std::string::const_iterator line_begin,
-    std::string::const_iterator line_end) {
+    StringPiece::const_iterator line_begin,
+    StringPiece::const_iterator line_end) {
   // Extract the version number
   ERL_NIF_TERM version = ParseVersion(env, line_begin, line_end);
   if (enif_is_atom(env, version)) {
     return version;
   }
 
-  std::string::const_iterator p = std::find(line_begin, line_end, ' ');
+  StringPiece::const_iterator p = std::find(line_begin, line_end, ' ');
   if (p == line_end) {
-    return enif_make_atom(env, "missing_status_code");
+    return MakeAtom(ATOM_missing_status_code);
   }
 
   // Skip whitespace.
-  while (*p == ' ')
+  while (p != line_end && *p == ' ')
     ++p;
 
-  std::string::const_iterator code = p;
-  while (*p >= '0' && *p <= '9')
+  StringPiece::const_iterator code = p;
+  while (p != line_end && *p >= '0' && *p <= '9')
     ++p;
 
   if (p == code) {
-    return enif_make_atom(env, "empty_status_code");
+    return MakeAtom(ATOM_empty_status_code);
   }
 
   int status_code;
-  if (!StringToInt(StringPiece(code, p), &status_code)) {
-    return enif_make_atom(env, "invalid_status_code");
+  if (!ParseDecimalInt(StringPiece(code, p), &status_code)) {
+    return MakeAtom(ATOM_invalid_status_code);
   }
 
   // Skip whitespace.
-  while (*p == ' ')
+  while (p != line_end && *p == ' ')
     ++p;
 
   // Trim trailing whitespace.
   while (line_end > p && line_end[-1] == ' ')
     --line_end;
 
-  std::string reason_phrase;
+  StringPiece reason_phrase;
   if (p < line_end) {
-    reason_phrase.assign(p, line_end);
+    reason_phrase = StringPiece(p, line_end);
   }
 
-  ERL_NIF_TERM status_line = enif_make_new_map(env);
-  enif_make_map_put(env, status_line, enif_make_atom(env, "version"), version,
-      &status_line);
-  enif_make_map_put(env, status_line, enif_make_atom(env, "status_code"),
-      enif_make_int(env, status_code), &status_line);
-  enif_make_map_put(env, status_line, enif_make_atom(env, "reason_phrase"),
-      MakeString(env, reason_phrase), &status_line);
+  ERL_NIF_TERM keys[] = {
+    MakeAtom(ATOM_version),
+    MakeAtom(ATOM_status_code),
+    MakeAtom(ATOM_reason_phrase),
+  };
+  ERL_NIF_TERM values[] = {
+    version,
+    enif_make_int(env, status_code),
+    MakeString(env, reason_phrase),
+  };
+  ERL_NIF_TERM status_line;
+  enif_make_map_from_arrays(env, keys, values, 3, &status_line);
   return status_line;
 }
 
 ERL_NIF_TERM ParseRequestLine(ErlNifEnv* env,
-    std::string::const_iterator line_begin,
-    std::string::const_iterator line_end) {
+    StringPiece::const_iterator line_begin,
+    StringPiece::const_iterator line_end) {
 
   // Skip any leading whitespace.
   while (line_begin != line_end &&
@@ -188,30 +696,30 @@ ERL_NIF_TERM ParseRequestLine(ErlNifEnv* env,
           *line_begin == '\r' || *line_begin == '\n'))
     ++line_begin;
 
-  std::string::const_iterator method_start = line_begin;
-  std::string::const_iterator p = std::find(line_begin, line_end, ' ');
+  StringPiece::const_iterator method_start = line_begin;
+  StringPiece::const_iterator p = std::find(line_begin, line_end, ' ');
 
   if (p == line_end) {
-    return enif_make_atom(env, "missing_method");
+    return MakeAtom(ATOM_missing_method);
   }
   
-  std::string method(method_start, p);
+  StringPiece method(method_start, p);
 
   // Skip whitespace.
-  while (*p == ' ')
+  while (p != line_end && *p == ' ')
     ++p;
 
-  std::string::const_iterator uri_start = p;
+  StringPiece::const_iterator uri_start = p;
   p = std::find(p, line_end, ' ');
 
   if (p == line_end) {
-    return enif_make_atom(env, "missing_uri");
+    return MakeAtom(ATOM_missing_uri);
   }
   
-  std::string uri(uri_start, p);
+  StringPiece uri(uri_start, p);
 
   // Skip whitespace.
-  while (*p == ' ')
+  while (p != line_end && *p == ' ')
     ++p;
 
   // Extract the version number
@@ -220,46 +728,55 @@ ERL_NIF_TERM ParseRequestLine(ErlNifEnv* env,
     return version;
   }
 
-  ERL_NIF_TERM request_line = enif_make_new_map(env);
-  enif_make_map_put(env, request_line, enif_make_atom(env, "method"),
-      MakeLowerCaseExistingAtomOrString(env, method), &request_line);
-  enif_make_map_put(env, request_line, enif_make_atom(env, "request_uri"),
-      MakeString(env, uri), &request_line);
-  enif_make_map_put(env, request_line, enif_make_atom(env, "version"), version,
-      &request_line);
+  ERL_NIF_TERM request_uri = MakeMessageUri(env, uri);
+  if (enif_is_atom(env, request_uri))
+    return request_uri;
+
+  ERL_NIF_TERM keys[] = {
+    MakeAtom(ATOM_method),
+    MakeAtom(ATOM_request_uri),
+    MakeAtom(ATOM_version),
+  };
+  ERL_NIF_TERM values[] = {
+    MakeMethod(env, method),
+    request_uri,
+    version,
+  };
+  ERL_NIF_TERM request_line;
+  enif_make_map_from_arrays(env, keys, values, 3, &request_line);
   return request_line;
 }
 
 ERL_NIF_TERM ParseToken(ErlNifEnv* env, Tokenizer* tok) {
-  std::string::const_iterator token_start = tok->Skip(SIP_LWS);
+  StringPiece::const_iterator token_start = tok->Skip(kLWSChars);
   if (tok->EndOfInput()) {
-    return enif_make_atom(env, "empty_value");
+    return MakeAtom(ATOM_empty_value);
   }
   return MakeString(env, StringPiece(token_start,
-      tok->SkipNotIn(SIP_LWS ";")));
+      tok->SkipNotIn(kLWSOrSemicolon)));
 }
 
 ERL_NIF_TERM ParseTypeSubtype(ErlNifEnv* env, Tokenizer* tok) {
-  std::string::const_iterator type_start = tok->Skip(SIP_LWS);
+  StringPiece::const_iterator type_start = tok->Skip(kLWSChars);
   if (tok->EndOfInput()) {
     // empty header is OK
     return enif_make_tuple(env, 0);
   }
-  StringPiece type(type_start, tok->SkipNotIn(SIP_LWS "/"));
+  StringPiece type(type_start, tok->SkipNotIn(kLWSOrSlash));
   if (!IsToken(type)) {
-    return enif_make_atom(env, "invalid_token");
+    return MakeAtom(ATOM_invalid_token);
   }
 
   tok->SkipTo('/');
   tok->Skip();
 
-  std::string::const_iterator subtype_start = tok->Skip(SIP_LWS);
+  StringPiece::const_iterator subtype_start = tok->Skip(kLWSChars);
   if (tok->EndOfInput()) {
-    return enif_make_atom(env, "missing_subtype");
+    return MakeAtom(ATOM_missing_subtype);
   }
-  StringPiece subtype(subtype_start, tok->SkipNotIn(SIP_LWS ";"));
+  StringPiece subtype(subtype_start, tok->SkipNotIn(kLWSOrSemicolon));
   if (!IsToken(subtype)) {
-    return enif_make_atom(env, "invalid_token");
+    return MakeAtom(ATOM_invalid_token);
   }
 
   return enif_make_tuple2(env, MakeLowerCaseString(env, type),
@@ -268,46 +785,47 @@ ERL_NIF_TERM ParseTypeSubtype(ErlNifEnv* env, Tokenizer* tok) {
 
 ERL_NIF_TERM ParseParameters(ErlNifEnv* env, Tokenizer* tok) {
   // TODO(balena): accept generic param such as ";token"
-  ERL_NIF_TERM result = enif_make_new_map(env);
   if (tok->EndOfInput())
-    return result;
+    return enif_make_new_map(env);
 
   tok->SkipTo(';');
   tok->Skip();
 
+  MapBuilder result(env);
   GenericParametersIterator it(tok->current(), tok->end());
   while (it.GetNext()) {
-    enif_make_map_put(env, result, MakeLowerCaseString(env, it.name()),
-        MakeString(env, it.value()), &result);
+    result.Put(
+        MakeLowerCaseString(env, StringPiece(it.name_begin(), it.name_end())),
+        MakeString(env, StringPiece(it.value_begin(), it.value_end())));
   }
-  return result;
+  return result.Build();
 }
 
 ERL_NIF_TERM ParseAuthScheme(ErlNifEnv* env, Tokenizer* tok) {
-  std::string::const_iterator scheme_start = tok->Skip(SIP_LWS);
+  StringPiece::const_iterator scheme_start = tok->Skip(kLWSChars);
   if (tok->EndOfInput())
-    return enif_make_atom(env, "missing_auth_scheme");
-  StringPiece scheme(scheme_start, tok->SkipNotIn(SIP_LWS));
+    return MakeAtom(ATOM_missing_auth_scheme);
+  StringPiece scheme(scheme_start, tok->SkipNotIn(kLWSChars));
   return MakeString(env, scheme);
 }
 
 ERL_NIF_TERM ParseAuthParams(ErlNifEnv* env, Tokenizer* tok) {
-  ERL_NIF_TERM result = enif_make_new_map(env);
+  MapBuilder result(env);
   NameValuePairsIterator it(tok->current(), tok->end(), ',');
   while (it.GetNext()) {
-    enif_make_map_put(env, result, MakeString(env, it.name()),
-        MakeString(env, Unquote(it.value_begin(), it.value_end())), &result);
+    result.Put(MakeString(env, StringPiece(it.name_begin(), it.name_end())),
+        MakeUnquotedString(env, it.value_begin(), it.value_end()));
   }
-  return result;
+  return result.Build();
 }
 
 ERL_NIF_TERM ParseComment(ErlNifEnv* env, Tokenizer* tok) {
   tok->SkipTo('(');
   if (tok->EndOfInput())
-    return enif_make_atom(env, "invalid_comment");
+    return MakeAtom(ATOM_invalid_comment);
 
-  std::string::const_iterator comment_start = tok->Skip();
-  std::string::const_iterator comment_end = tok->end();
+  StringPiece::const_iterator comment_start = tok->Skip();
+  StringPiece::const_iterator comment_end = tok->end();
 
   int lparen = 1;
   while (!tok->EndOfInput()) {
@@ -324,7 +842,7 @@ ERL_NIF_TERM ParseComment(ErlNifEnv* env, Tokenizer* tok) {
   }
 
   if (comment_end == tok->end())
-    return enif_make_atom(env, "invalid_comment");
+    return MakeAtom(ATOM_invalid_comment);
 
   TrimLWS(&comment_start, &comment_end);
   StringPiece comment(comment_start, comment_end);
@@ -334,20 +852,20 @@ ERL_NIF_TERM ParseComment(ErlNifEnv* env, Tokenizer* tok) {
 ERL_NIF_TERM ParseUri(ErlNifEnv* env, Tokenizer* tok) {
   tok->SkipTo('<');
   if (tok->EndOfInput())
-    return enif_make_atom(env, "invalid_uri");
-  std::string::const_iterator uri_start = tok->Skip();
-  std::string::const_iterator uri_end = tok->SkipTo('>');
+    return MakeAtom(ATOM_invalid_uri);
+  StringPiece::const_iterator uri_start = tok->Skip();
+  StringPiece::const_iterator uri_end = tok->SkipTo('>');
   if (tok->EndOfInput())
-    return enif_make_atom(env, "unclosed_laquot");
+    return MakeAtom(ATOM_unclosed_laquot);
   tok->Skip();
   StringPiece uri(uri_start, uri_end);
-  return MakeString(env, uri);
+  return MakeMessageUri(env, uri);
 }
 
 ERL_NIF_TERM ParseContact(ErlNifEnv* env, Tokenizer* tok) {
-  std::string::const_iterator display_name_start, display_name_end;
+  StringPiece::const_iterator display_name_start, display_name_end;
   StringPiece address;
-  tok->Skip(SIP_LWS);
+  tok->Skip(kLWSChars);
   if (IsQuote(*tok->current())) {
     // contact-param = quoted-string LAQUOT addr-spec RAQUOT
     display_name_start = tok->current();
@@ -361,15 +879,15 @@ ERL_NIF_TERM ParseContact(ErlNifEnv* env, Tokenizer* tok) {
         break;
     }
     if (tok->EndOfInput())
-      return enif_make_atom(env, "unclosed_qstring");
+      return MakeAtom(ATOM_unclosed_qstring);
     display_name_end = tok->Skip();
     tok->SkipTo('<');
     if (tok->EndOfInput())
-      return enif_make_atom(env, "missing_address");
-    std::string::const_iterator address_start = tok->Skip();
+      return MakeAtom(ATOM_missing_address);
+    StringPiece::const_iterator address_start = tok->Skip();
     tok->SkipTo('>');
     if (tok->EndOfInput())
-      return enif_make_atom(env, "unclosed_laquot");
+      return MakeAtom(ATOM_unclosed_laquot);
     address = StringPiece(address_start, tok->current());
   } else {
     Tokenizer laquot(tok->current(), tok->end());
@@ -379,29 +897,31 @@ ERL_NIF_TERM ParseContact(ErlNifEnv* env, Tokenizer* tok) {
       display_name_start = tok->current();
       display_name_end = laquot.current();
       TrimLWS(&display_name_start, &display_name_end);
-      std::string::const_iterator address_start = laquot.Skip();
+      StringPiece::const_iterator address_start = laquot.Skip();
       laquot.SkipTo('>');
       if (laquot.EndOfInput())
-        return enif_make_atom(env, "unclosed_laquot");
+        return MakeAtom(ATOM_unclosed_laquot);
       address = StringPiece(address_start, laquot.current());
       tok->set_current(laquot.Skip());
     } else if (IsToken(tok->current(), tok->current() + 1)) {
       display_name_start = display_name_end = tok->end();
-      std::string::const_iterator address_start = tok->current();
-      address = StringPiece(address_start, tok->SkipNotIn(SIP_LWS ";"));
+      StringPiece::const_iterator address_start = tok->current();
+      address = StringPiece(address_start, tok->SkipNotIn(kLWSOrSemicolon));
     } else {
-      return enif_make_atom(env, "invalid_char_found");
+      return MakeAtom(ATOM_invalid_char_found);
     }
   }
 
-  std::string display_name(Unquote(display_name_start, display_name_end));
-  return enif_make_tuple2(env, MakeString(env, display_name),
-      MakeString(env, address));
+  ERL_NIF_TERM uri = MakeMessageUri(env, address);
+  if (enif_is_atom(env, uri))
+    return uri;
+  return enif_make_tuple2(env,
+      MakeUnquotedString(env, display_name_start, display_name_end), uri);
 }
 
 bool ParseStar(ErlNifEnv* env, Tokenizer* tok, ERL_NIF_TERM* term) {
   Tokenizer star(tok->current(), tok->end());
-  star.Skip(SIP_LWS);
+  star.Skip(kLWSChars);
   if (star.EndOfInput())
     return false;
   if (*star.current() != '*')
@@ -411,24 +931,24 @@ bool ParseStar(ErlNifEnv* env, Tokenizer* tok, ERL_NIF_TERM* term) {
 }
 
 ERL_NIF_TERM ParseWarning(ErlNifEnv* env, Tokenizer* tok) {
-  std::string::const_iterator code_start = tok->Skip(SIP_LWS);
+  StringPiece::const_iterator code_start = tok->Skip(kLWSChars);
   if (tok->EndOfInput())
-    return enif_make_atom(env, "empty_input");
-  StringPiece code_string(code_start, tok->SkipNotIn(SIP_LWS));
+    return MakeAtom(ATOM_empty_input);
+  StringPiece code_string(code_start, tok->SkipNotIn(kLWSChars));
   int code = 0;
-  if (!StringToInt(code_string, &code)
+  if (!ParseDecimalInt(code_string, &code)
       || code < 100 || code > 999)
-    return enif_make_atom(env, "invalid_code");
-  std::string::const_iterator agent_start = tok->Skip(SIP_LWS);
+    return MakeAtom(ATOM_invalid_code);
+  StringPiece::const_iterator agent_start = tok->Skip(kLWSChars);
   if (tok->EndOfInput())
-    return enif_make_atom(env, "empty_warn_agent");
-  StringPiece agent(agent_start, tok->SkipNotIn(SIP_LWS));
-  tok->Skip(SIP_LWS);
+    return MakeAtom(ATOM_empty_warn_agent);
+  StringPiece agent(agent_start, tok->SkipNotIn(kLWSChars));
+  tok->Skip(kLWSChars);
   if (tok->EndOfInput())
-    return enif_make_atom(env, "missing_warn_text");
+    return MakeAtom(ATOM_missing_warn_text);
   if (*tok->current() != '"')
-    return enif_make_atom(env, "invalid_warn_text");
-  std::string::const_iterator text_start = tok->current();
+    return MakeAtom(ATOM_invalid_warn_text);
+  StringPiece::const_iterator text_start = tok->current();
   tok->Skip();
   for (; !tok->EndOfInput(); tok->Skip()) {
     if (*tok->current() == '\\') {
@@ -439,67 +959,97 @@ ERL_NIF_TERM ParseWarning(ErlNifEnv* env, Tokenizer* tok) {
       break;
   }
   if (tok->EndOfInput())
-    return enif_make_atom(env, "unclosed_qstring");
-  std::string text(text_start, tok->Skip());
-  text = Unquote(text.begin(), text.end());
+    return MakeAtom(ATOM_unclosed_qstring);
+  ArenaString text(Unquote(text_start, tok->Skip()));
   return enif_make_tuple3(env, enif_make_int(env, code),
-      MakeString(env, agent), MakeString(env, text));
+      MakeString(env, agent), MakeArenaString(env, text));
+}
+
+// Makes the :inet.ip_address() tuple of a numeric host, as
+// :inet.parse_address/1 would, without copying it. Returns false for
+// hostnames. Only bracketed hosts are taken as IPv6 addresses.
+bool MakeInetAddress(ErlNifEnv* env, StringPiece host, bool bracketed,
+    ERL_NIF_TERM* term) {
+  if (bracketed) {
+    uint16_t groups[8];
+    if (!ParseIPv6Address(host, groups))
+      return false;
+    ERL_NIF_TERM elements[8];
+    for (int i = 0; i < 8; ++i)
+      elements[i] = enif_make_uint(env, groups[i]);
+    *term = enif_make_tuple_from_array(env, elements, 8);
+  } else {
+    uint8_t bytes[4];
+    if (!ParseIPv4Address(host, bytes))
+      return false;
+    *term = enif_make_tuple4(env, enif_make_uint(env, bytes[0]),
+        enif_make_uint(env, bytes[1]), enif_make_uint(env, bytes[2]),
+        enif_make_uint(env, bytes[3]));
+  }
+  return true;
+}
+
+// The port of a Via sent-by without one, by transport protocol.
+int DefaultViaPort(StringPiece protocol) {
+  if (LowerCaseEqualsASCII(protocol, "udp")
+      || LowerCaseEqualsASCII(protocol, "tcp"))
+    return 5060;
+  if (LowerCaseEqualsASCII(protocol, "tls"))
+    return 5061;
+  return 0;
 }
 
 ERL_NIF_TERM ParseVia(ErlNifEnv* env, Tokenizer* tok) {
-  std::string::const_iterator version_start = tok->Skip(SIP_LWS);
+  StringPiece::const_iterator version_start = tok->Skip(kLWSChars);
   if ((tok->end() - tok->current() < 3)
       || !LowerCaseEqualsASCII(
           StringPiece(tok->current(), tok->current() + 3), "sip"))
-    return enif_make_atom(env, "unknown_version");
+    return MakeAtom(ATOM_unknown_version);
   tok->SkipTo('/');
   tok->Skip();
   ERL_NIF_TERM version = ParseVersion(env, version_start, tok->SkipTo('/'));
   if (enif_is_atom(env, version))
     return version;
   tok->Skip();
-  std::string::const_iterator protocol_start = tok->Skip(SIP_LWS);
+  StringPiece::const_iterator protocol_start = tok->Skip(kLWSChars);
   if (tok->EndOfInput())
-    return enif_make_atom(env, "missing_sent_protocol");
-  std::string protocol(protocol_start, tok->SkipNotIn(SIP_LWS));
-  protocol = ToLowerASCII(protocol);
-  std::string::const_iterator sentby_start = tok->Skip(SIP_LWS);
+    return MakeAtom(ATOM_missing_sent_protocol);
+  ArenaString protocol(protocol_start, tok->SkipNotIn(kLWSChars));
+  for (auto& c : protocol)
+    c = ToLowerASCII(c);
+  StringPiece::const_iterator sentby_start = tok->Skip(kLWSChars);
   if (tok->EndOfInput())
-    return enif_make_atom(env, "missing_sentby");
-  std::string::const_iterator sentby_end = tok->SkipTo(';');
+    return MakeAtom(ATOM_missing_sentby);
+  StringPiece::const_iterator sentby_end = tok->SkipTo(';');
   TrimLWS(&sentby_start, &sentby_end);
   StringPiece sentby_string(sentby_start, sentby_end);
   if (sentby_string.empty())
-    return enif_make_atom(env, "missing_sentby");
-  std::string host;
+    return MakeAtom(ATOM_missing_sentby);
+  StringPiece host;
   int port;
-  if (!ParseHostAndPort(sentby_string.as_string(), &host, &port))
-    return enif_make_atom(env, "invalid_sentby");
-  if (port == -1) {
-    if (protocol == "udp" || protocol == "tcp")
-      port = 5060;
-    else if (protocol == "tls")
-      port = 5061;
-    else
-      port = 0;
-  }
-  if (host[0] == '[')  // remove brackets from IPv6 addresses
-    host = host.substr(1, host.size()-2);
+  if (!ParseHostAndPort(sentby_string, &host, &port))
+    return MakeAtom(ATOM_invalid_sentby);
+  if (port == -1)
+    port = DefaultViaPort(StringPiece(protocol.data(), protocol.size()));
+  ERL_NIF_TERM host_term;
+  if (g_input == nullptr || !g_input->options().inet_addresses
+      || !MakeInetAddress(env, host, sentby_string[0] == '[', &host_term))
+    host_term = MakeString(env, host);
   return enif_make_tuple3(env, version,
-      MakeLowerCaseExistingAtomOrString(env, protocol),
-      enif_make_tuple2(env, MakeString(env, host), enif_make_int(env, port)));
+      MakeProtocol(env, StringPiece(protocol.data(), protocol.size())),
+      enif_make_tuple2(env, host_term, enif_make_int(env, port)));
 }
 
 ERL_NIF_TERM ParseSingleToken(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
   return ParseToken(env, &tok);
 }
 
 ERL_NIF_TERM ParseSingleTokenParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
   ERL_NIF_TERM value = ParseToken(env, &tok);
   if (enif_is_atom(env, value))
@@ -511,8 +1061,8 @@ ERL_NIF_TERM ParseSingleTokenParams(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseMultipleTokens(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   ERL_NIF_TERM result = enif_make_list(env, 0);
   ValuesIterator it(values_begin, values_end, ',');
   while (it.GetNext()) {
@@ -527,8 +1077,8 @@ ERL_NIF_TERM ParseMultipleTokens(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseMultipleTokenParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   ERL_NIF_TERM result = enif_make_list(env, 0);
   ValuesIterator it(values_begin, values_end, ',');
   while (it.GetNext()) {
@@ -543,8 +1093,8 @@ ERL_NIF_TERM ParseMultipleTokenParams(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseSingleTypeSubtypeParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
   ERL_NIF_TERM value = ParseTypeSubtype(env, &tok);
   if (enif_is_atom(env, value))
@@ -556,8 +1106,8 @@ ERL_NIF_TERM ParseSingleTypeSubtypeParams(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseMultipleTypeSubtypeParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   ERL_NIF_TERM result = enif_make_list(env, 0);
   ValuesIterator it(values_begin, values_end, ',');
   while (it.GetNext()) {
@@ -572,8 +1122,8 @@ ERL_NIF_TERM ParseMultipleTypeSubtypeParams(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseMultipleUriParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   ERL_NIF_TERM result = enif_make_list(env, 0);
   ValuesIterator it(values_begin, values_end, ',');
   while (it.GetNext()) {
@@ -592,27 +1142,27 @@ ERL_NIF_TERM ParseMultipleUriParams(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseSingleInteger(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
-  std::string::const_iterator token_start = tok.Skip(SIP_LWS);
-  std::string digits(token_start, tok.SkipNotIn(SIP_LWS));
+  StringPiece::const_iterator token_start = tok.Skip(kLWSChars);
+  StringPiece digits(token_start, tok.SkipNotIn(kLWSChars));
   int i = 0;
-  if (!StringToInt(digits, &i))
-    return enif_make_atom(env, "invalid_digits");
+  if (!ParseDecimalInt(digits, &i))
+    return MakeAtom(ATOM_invalid_digits);
   return enif_make_int(env, i);
 }
 
 ERL_NIF_TERM ParseOnlyAuthParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
   return ParseAuthParams(env, &tok);
 }
 
 ERL_NIF_TERM ParseSchemeAndAuthParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
   ERL_NIF_TERM scheme = ParseAuthScheme(env, &tok);
   if (enif_is_atom(env, scheme))
@@ -625,8 +1175,8 @@ ERL_NIF_TERM ParseSchemeAndAuthParams(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseSingleContactParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
   ERL_NIF_TERM contact = ParseContact(env, &tok);
   if (enif_is_atom(env, contact))
@@ -642,8 +1192,8 @@ ERL_NIF_TERM ParseSingleContactParams(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseMultipleContactParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   ERL_NIF_TERM result = enif_make_list(env, 0);
   ValuesIterator it(values_begin, values_end, ',');
   while (it.GetNext()) {
@@ -658,8 +1208,8 @@ ERL_NIF_TERM ParseMultipleContactParams(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseStarOrMultipleContactParams(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
   ERL_NIF_TERM star;
   if (ParseStar(env, &tok, &star)) {
@@ -670,46 +1220,51 @@ ERL_NIF_TERM ParseStarOrMultipleContactParams(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseTrimmedUtf8(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   TrimLWS(&values_begin, &values_end);
   return MakeString(env, StringPiece(values_begin, values_end));
 }
 
 ERL_NIF_TERM ParseCseq(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
-  std::string::const_iterator integer_start = tok.Skip(SIP_LWS);
+  StringPiece::const_iterator integer_start = tok.Skip(kLWSChars);
   if (tok.EndOfInput())
-    return enif_make_atom(env, "missing_sequence");
-  std::string integer_string(integer_start, tok.SkipNotIn(SIP_LWS));
+    return MakeAtom(ATOM_missing_sequence);
+  StringPiece integer_string(integer_start, tok.SkipNotIn(kLWSChars));
   int sequence = 0;
-  if (!StringToInt(integer_string, &sequence))
-    return enif_make_atom(env, "invalid_sequence");
-  std::string::const_iterator method_start = tok.Skip(SIP_LWS);
+  if (!ParseDecimalInt(integer_string, &sequence))
+    return MakeAtom(ATOM_invalid_sequence);
+  StringPiece::const_iterator method_start = tok.Skip(kLWSChars);
   if (tok.EndOfInput())
-    return enif_make_atom(env, "missing_method");
-  StringPiece method_name(method_start, tok.SkipNotIn(SIP_LWS));
+    return MakeAtom(ATOM_missing_method);
+  StringPiece method_name(method_start, tok.SkipNotIn(kLWSChars));
   return enif_make_tuple2(env, enif_make_int(env, sequence),
-      MakeLowerCaseExistingAtomOrString(env, method_name));
+      MakeMethod(env, method_name));
 }
 
 ERL_NIF_TERM ParseDate(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   TrimLWS(&values_begin, &values_end);
   if (values_begin == values_end)
-    return enif_make_atom(env, "empty_date");
+    return MakeAtom(ATOM_empty_date);
 
   PRExplodedTime result_time;
-  std::string time_string(StringPiece(values_begin, values_end).as_string());
-  PRStatus status = PR_ParseTimeStringToExplodedTime(time_string.c_str(),
-      PR_TRUE, &result_time);
-  if (PR_SUCCESS != status)
-    return enif_make_atom(env, "invalid_date");
-
-  PR_NormalizeTime(&result_time, &PR_GMTParameters);
+  if (!ParseRFC1123Date(StringPiece(values_begin, values_end),
+          &result_time)) {
+    // Dates in other formats are rare, and left to the general parser.
+    g_date_fallback_count.fetch_add(1, std::memory_order_relaxed);
+    ArenaString time_string(values_begin, values_end);
+    PRStatus status = PR_ParseTimeStringToExplodedTime(time_string.c_str(),
+        PR_TRUE, &result_time);
+    if (PR_SUCCESS != status)
+      return MakeAtom(ATOM_invalid_date);
+
+    PR_NormalizeTime(&result_time, &PR_GMTParameters);
+  }
 
   ERL_NIF_TERM result = enif_make_tuple3(env,
       enif_make_tuple3(env,
@@ -727,22 +1282,22 @@ ERL_NIF_TERM ParseDate(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseTimestamp(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
-  std::string::const_iterator timestamp_start = tok.Skip(SIP_LWS);
+  StringPiece::const_iterator timestamp_start = tok.Skip(kLWSChars);
   if (tok.EndOfInput())
-    return enif_make_atom(env, "missing_timestamp");
-  StringPiece timestamp_string(timestamp_start, tok.SkipNotIn(SIP_LWS));
+    return MakeAtom(ATOM_missing_timestamp);
+  StringPiece timestamp_string(timestamp_start, tok.SkipNotIn(kLWSChars));
   double timestamp = .0;
-  if (!StringToDouble(timestamp_string, &timestamp))
-    return enif_make_atom(env, "invalid_timestamp");
+  if (!ParseDecimalDouble(timestamp_string, &timestamp))
+    return MakeAtom(ATOM_invalid_timestamp);
   // delay is optional
   double delay = .0;
-  std::string::const_iterator delay_start = tok.Skip(SIP_LWS);
+  StringPiece::const_iterator delay_start = tok.Skip(kLWSChars);
   if (!tok.EndOfInput()) {
-    StringPiece delay_string(delay_start, tok.SkipNotIn(SIP_LWS));
-    StringToDouble(delay_string, &delay);
+    StringPiece delay_string(delay_start, tok.SkipNotIn(kLWSChars));
+    ParseDecimalDouble(delay_string, &delay);
     // ignore errors parsing the optional delay
   }
   return enif_make_tuple2(env, enif_make_double(env, timestamp),
@@ -750,40 +1305,40 @@ ERL_NIF_TERM ParseTimestamp(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseMimeVersion(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
-  std::string::const_iterator major_start = tok.Skip(SIP_LWS);
+  StringPiece::const_iterator major_start = tok.Skip(kLWSChars);
   if (tok.EndOfInput())
-    return enif_make_atom(env, "missing_major");
+    return MakeAtom(ATOM_missing_major);
   StringPiece major_string(major_start, tok.SkipTo('.'));
   int major = 0;
   if (major_string.empty()
-      || !StringToInt(major_string, &major))
-    return enif_make_atom(env, "missing_or_invalid_major");
+      || !ParseDecimalInt(major_string, &major))
+    return MakeAtom(ATOM_missing_or_invalid_major);
   tok.Skip();
-  std::string::const_iterator minor_start = tok.Skip(SIP_LWS);
+  StringPiece::const_iterator minor_start = tok.Skip(kLWSChars);
   StringPiece minor_string(minor_start, tok.end());
   int minor = 0;
   if (minor_string.empty()
-      || !StringToInt(minor_string, &minor))
-    return enif_make_atom(env, "invalid_minor");
+      || !ParseDecimalInt(minor_string, &minor))
+    return MakeAtom(ATOM_invalid_minor);
   return enif_make_tuple2(env, enif_make_int(env, major),
       enif_make_int(env, minor));
 }
 
 ERL_NIF_TERM ParseRetryAfter(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   Tokenizer tok(values_begin, values_end);
-  std::string::const_iterator delta_start = tok.Skip(SIP_LWS);
+  StringPiece::const_iterator delta_start = tok.Skip(kLWSChars);
   if (tok.EndOfInput())
-    return enif_make_atom(env, "missing_delta_secs");
-  StringPiece delta_string(delta_start, tok.SkipNotIn(SIP_LWS "(;"));
+    return MakeAtom(ATOM_missing_delta_secs);
+  StringPiece delta_string(delta_start, tok.SkipNotIn(kDeltaSecondsEnd));
   int delta_seconds = 0;
   if (delta_string.empty()
-      || !StringToInt(delta_string, &delta_seconds))
-    return enif_make_atom(env, "missing_or_invalid_delta_secs");
+      || !ParseDecimalInt(delta_string, &delta_seconds))
+    return MakeAtom(ATOM_missing_or_invalid_delta_secs);
 
   ERL_NIF_TERM comment;
   StringPiece remaining(tok.current(), tok.end());
@@ -810,8 +1365,8 @@ ERL_NIF_TERM ParseRetryAfter(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseMultipleWarnings(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   ERL_NIF_TERM result = enif_make_list(env, 0);
   ValuesIterator it(values_begin, values_end, ',');
   while (it.GetNext()) {
@@ -826,8 +1381,8 @@ ERL_NIF_TERM ParseMultipleWarnings(ErlNifEnv* env,
 }
 
 ERL_NIF_TERM ParseMultipleVias(ErlNifEnv* env,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
   ERL_NIF_TERM result = enif_make_list(env, 0);
   ValuesIterator it(values_begin, values_end, ',');
   while (it.GetNext()) {
@@ -849,26 +1404,27 @@ ERL_NIF_TERM ParseMultipleVias(ErlNifEnv* env,
   return result;
 }
 
-ERL_NIF_TERM ParseHeader(ErlNifEnv* env,
-    std::string::const_iterator name_begin,
-    std::string::const_iterator name_end,
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end) {
-  ERL_NIF_TERM header_name_term = 0, header_values_term;
+// Parsers of the headers listed in header_list.h, by header index.
+const ParseFunction kParsers[] = {
+#define X(header_name, compact_form, atom_name, format) \
+  &Parse##format,
+#include "header_list.h"
+#undef X
+};
+
+// Parses a header line; |index| is HEADER_COUNT for headers not listed in
+// header_list.h.
+ERL_NIF_TERM ParseHeader(ErlNifEnv* env, HeaderIndex index,
+    StringPiece::const_iterator name_begin,
+    StringPiece::const_iterator name_end,
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end) {
+  ERL_NIF_TERM header_name_term, header_values_term;
   StringPiece header_name(name_begin, name_end);
   StringPiece header_values(values_begin, values_end);
-  if (header_name.size() == 1) {
-    auto alias = g_aliases.find(ToLowerASCII(header_name[0]));
-    if (alias != g_aliases.end()) {
-      header_name_term = alias->second;
-    }
-  }
-  if (header_name_term == 0) {
-    MakeLowerCaseExistingAtom(env, header_name, &header_name_term);
-  }
-  auto f = g_parsers.find(header_name_term);
-  if (f != g_parsers.end()) {
-    header_values_term = (f->second)(env, values_begin, values_end);
+  if (index != HEADER_COUNT) {
+    header_name_term = g_priv->header_atoms[index];
+    header_values_term = kParsers[index](env, values_begin, values_end);
     if (enif_is_atom(env, header_values_term))
       return header_values_term;
   } else {
@@ -879,22 +1435,20 @@ ERL_NIF_TERM ParseHeader(ErlNifEnv* env,
 }
 
 bool AssembleRawHeaders(const char* input, size_t length,
-    std::string *output) {
+    std::string *output, InputBinary* source) {
   const char* line_start;
   const char* line_end;
 
   output->reserve(length);
   for (size_t i = 0; i < length; i++) {
     line_start = input + i;
-    do {
-      char c = *(input + i);
-      if (c == '\r' || c == '\n')
-        break;
-      i++;
-    } while (i < length);
-    line_end = input + i;
-    if (line_start != line_end)
+    line_end = FindLineBreak(line_start, input + length);
+    i = line_end - input;
+    if (line_start != line_end) {
+      source->AddSegment(output->size(), line_start - input,
+          line_end - line_start);
       output->append(line_start, line_end);
+    }
     if (i == length)
       break;
     // now inspect the next character
@@ -918,140 +1472,2349 @@ bool AssembleRawHeaders(const char* input, size_t length,
   return true;
 }
 
-ERL_NIF_TERM Parse(ErlNifEnv* env, const char* raw_message, size_t length) {
-  std::string input;
-  if (!AssembleRawHeaders(raw_message, length, &input)) {
-    return enif_make_tuple2(env, enif_make_atom(env, "error"),
-        enif_make_atom(env, "invalid_line_break"));
+// Checks the line breaks of the input, setting |*has_folding| if any header
+// value continues on the next line. Returns false if a CR is not followed by
+// a LF.
+bool ScanLineBreaks(const char* input, size_t length, bool* has_folding) {
+  const char* end = input + length;
+  *has_folding = false;
+  for (const char* p = FindLineBreak(input, end); p != end;
+       p = FindLineBreak(p, end)) {
+    if (*p++ == '\r') {
+      if (p == end || *p != '\n')
+        return false;  // invalid CRLF sequence
+      ++p;
+    }
+    if (p != end && IsLWS(*p))
+      *has_folding = true;
   }
+  return true;
+}
 
-  ERL_NIF_TERM message = enif_make_new_map(env);
-  std::string::const_iterator i = input.begin();
-  std::string::const_iterator end = input.end();
-  std::string::const_iterator start = i;
+// Finds the empty line separating the header section of |input| from the
+// body. Returns true and sets |*headers_length| and |*body_offset| if there
+// is one; otherwise the whole input is the header section, and the empty
+// body is at its end.
+bool SplitBody(const char* input, size_t length, size_t* headers_length,
+    size_t* body_offset) {
+  const char* headers_end;
+  const char* body_begin;
+  if (!FindEmptyLine(input, input + length, &headers_end, &body_begin)) {
+    *headers_length = length;
+    *body_offset = length;
+    return false;
+  }
+  *headers_length = headers_end - input;
+  *body_offset = body_begin - input;
+  return true;
+}
 
-  ERL_NIF_TERM start_line;
-  
-  i = FindLineEnd(start, end);
-  if (IsStatusLine(start, i)) {
-    start_line = ParseStatusLine(env, start, i);
+// Checks the line breaks of |raw_message| and sets |*input| to the text to
+// be parsed: the message itself, or a copy in |*assembled| with the
+// continuation lines joined. Returns false on invalid line breaks.
+bool PrepareInput(const char* raw_message, size_t length,
+    std::string* assembled, InputBinary* source, StringPiece* input) {
+  // Line folding is rare, so the input is only copied when there are
+  // continuation lines to join; otherwise it is parsed in place.
+  bool has_folding;
+  if (!ScanLineBreaks(raw_message, length, &has_folding))
+    return false;
+  if (has_folding) {
+    g_folded_count.fetch_add(1, std::memory_order_relaxed);
+    assembled->clear();
+    if (!AssembleRawHeaders(raw_message, length, assembled, source))
+      return false;
+    *input = *assembled;
   } else {
-    start_line = ParseRequestLine(env, start, i);
+    source->AddSegment(0, 0, length);
+    *input = StringPiece(raw_message, length);
   }
+  source->set_assembled(input->data());
+  return true;
+}
 
-  if (enif_is_atom(env, start_line))
-    return start_line;
-  enif_make_map_put(env, message, enif_make_atom(env, "start_line"),
-      start_line, &message);
-
-  // Jump over next CRLF
+// Jumps over the line break at |i|, if any.
+StringPiece::const_iterator SkipLineBreak(StringPiece::const_iterator i,
+    StringPiece::const_iterator end) {
   if (i != end) {
     if (*i == '\r')
       ++i;
     if (i != end && *i == '\n')
       ++i;
   }
+  return i;
+}
+
+// Parses the first line of |input|, setting |*headers_begin| to the start of
+// the following line. Returns an atom on errors.
+ERL_NIF_TERM ParseStartLine(ErlNifEnv* env, StringPiece input,
+    StringPiece::const_iterator* headers_begin) {
+  StringPiece::const_iterator start = input.begin();
+  StringPiece::const_iterator end = input.end();
+  StringPiece::const_iterator i = FindLineEnd(start, end);
+
+  ERL_NIF_TERM start_line;
+  if (IsStatusLine(start, i)) {
+    start_line = ParseStatusLine(env, start, i);
+  } else {
+    start_line = ParseRequestLine(env, start, i);
+  }
+
+  *headers_begin = SkipLineBreak(i, end);
+  return start_line;
+}
+
+// Joins the value lists of the |count| lines of a header into a single list,
+// built at once. A header with a single line is returned as is.
+ERL_NIF_TERM JoinHeaderValues(ErlNifEnv* env, const ERL_NIF_TERM* values,
+    size_t count, std::vector<ERL_NIF_TERM>* elements) {
+  if (count == 1)
+    return values[0];
+  elements->clear();
+  for (size_t i = 0; i < count; ++i) {
+    ERL_NIF_TERM head, tail = values[i];
+    while (enif_get_list_cell(env, tail, &head, &tail))
+      elements->push_back(head);
+  }
+  return enif_make_list_from_array(env, elements->data(),
+      static_cast<unsigned>(elements->size()));
+}
+
+// Collects the parsed header lines of a message, grouping the lines of each
+// header, then builds the headers map with one list per header.
+class HeaderCollector {
+ public:
+  HeaderCollector(ErlNifEnv* env, ParseScratch* scratch)
+    : env_(env), lines_(scratch->headers), terms_(scratch->terms),
+      unknown_first_(scratch->unknown_headers) {
+    lines_.clear();
+    unknown_first_.clear();
+    std::fill(first_, first_ + HEADER_COUNT, kNoLine);
+  }
+
+  // Adds a header line named |name_string|, whose |name| term is its key in
+  // the headers map; |index| is HEADER_COUNT for headers not listed in
+  // header_list.h. Returns false if the header appeared before and does not
+  // accept multiple values.
+  bool Add(HeaderIndex index, StringPiece name_string, ERL_NIF_TERM name,
+      ERL_NIF_TERM values, StringPiece raw_line) {
+    size_t line = lines_.size();
+    size_t first = kNoLine;
+    if (index != HEADER_COUNT) {
+      first = first_[index];
+      if (first == kNoLine)
+        first_[index] = line;
+    } else {
+      auto inserted = unknown_first_.emplace(name_string, line);
+      if (!inserted.second)
+        first = inserted.first->second;
+    }
+    if (first != kNoLine && !enif_is_list(env_, lines_[first].values))
+      return false;
+
+    lines_.push_back(ParsedHeader{index, name, values, raw_line, kNoLine,
+        line, first == kNoLine});
+    if (first != kNoLine) {
+      lines_[lines_[first].last].next = line;
+      lines_[first].last = line;
+    }
+    return true;
+  }
+
+  // Builds the headers map. If |source| is given, also builds the map of
+  // the raw_headers option, with a {value, lines} tuple per header.
+  ERL_NIF_TERM Build(const InputBinary* source, ERL_NIF_TERM* raw_headers) {
+    std::vector<ERL_NIF_TERM> keys, values, lists, raw_values, raw_lines;
+    for (const ParsedHeader& header : lines_) {
+      if (!header.first)
+        continue;
+      lists.clear();
+      raw_lines.clear();
+      for (const ParsedHeader* line = &header; ;
+           line = &lines_[line->next]) {
+        lists.push_back(line->values);
+        if (source != nullptr)
+          raw_lines.push_back(source->MakeRawLine(env_, line->raw_line));
+        if (line->next == kNoLine)
+          break;
+      }
+      keys.push_back(header.name);
+      values.push_back(JoinHeaderValues(env_, lists.data(), lists.size(),
+          &terms_));
+      if (source != nullptr) {
+        raw_values.push_back(enif_make_tuple2(env_, values.back(),
+            enif_make_list_from_array(env_, raw_lines.data(),
+                static_cast<unsigned>(raw_lines.size()))));
+      }
+    }
+    ERL_NIF_TERM map;
+    enif_make_map_from_arrays(env_, keys.data(), values.data(), keys.size(),
+        &map);
+    if (source != nullptr) {
+      enif_make_map_from_arrays(env_, keys.data(), raw_values.data(),
+          keys.size(), raw_headers);
+    }
+    return map;
+  }
+
+ private:
+  ErlNifEnv* env_;
+  std::vector<ParsedHeader>& lines_;
+  std::vector<ERL_NIF_TERM>& terms_;
+  std::unordered_map<StringPiece, size_t, StringPieceHash>& unknown_first_;
+  // The first line of each header listed in header_list.h.
+  size_t first_[HEADER_COUNT];
+};
+
+ERL_NIF_TERM Parse(ErlNifEnv* env, ERL_NIF_TERM binary,
+    const ParseOptions& options, ParseScratch* scratch) {
+  ScopedArena scoped_arena;
+  ErlNifBinary bin;
+  enif_inspect_binary(env, binary, &bin);
+  const char* raw_message = reinterpret_cast<const char*>(bin.data);
+  size_t length = static_cast<size_t>(bin.size);
+
+  size_t headers_length, body_offset;
+  bool has_body = SplitBody(raw_message, length, &headers_length,
+      &body_offset);
+
+  StringPiece input;
+  InputBinary source(binary, length, options, &scratch->segments);
+  if (!PrepareInput(raw_message, headers_length, &scratch->assembled, &source,
+          &input)) {
+    return enif_make_tuple2(env, MakeAtom(ATOM_error),
+        MakeAtom(ATOM_invalid_line_break));
+  }
+  ScopedInputBinary scoped_input(&source);
+
+  StringPiece::const_iterator i;
+  ERL_NIF_TERM start_line = ParseStartLine(env, input, &i);
+  if (enif_is_atom(env, start_line))
+    return start_line;
 
-  HeadersIterator it(i, end, "\r\n");
-  ERL_NIF_TERM headers = enif_make_new_map(env);
+  HeadersIterator it(i, input.end(), "\r\n");
+  HeaderCollector headers(env, scratch);
+  StringPiece content_length;
+  bool has_content_length = false;
   while (it.GetNext()) {
-    ERL_NIF_TERM header = ParseHeader(env, it.name_begin(), it.name_end(),
-        it.values_begin(), it.values_end());
+    HeaderIndex index;
+    if (!LookupHeader(StringPiece(it.name_begin(), it.name_end()), &index))
+      index = HEADER_COUNT;
+    if (index == HEADER_content_length) {
+      content_length = StringPiece(it.values_begin(), it.values_end());
+      has_content_length = true;
+    }
+    if (!options.IsSelected(index))
+      continue;
+
+    ERL_NIF_TERM header = ParseHeader(env, index, it.name_begin(),
+        it.name_end(), it.values_begin(), it.values_end());
     if (enif_is_atom(env, header))
-      return enif_make_tuple2(env, enif_make_atom(env, "error"),
+      return enif_make_tuple2(env, MakeAtom(ATOM_error),
           header);
 
     int arity;
     const ERL_NIF_TERM* pair;
-    if (enif_get_tuple(env, header, &arity, &pair) && arity == 2) {
-      ERL_NIF_TERM header_name = pair[0], header_values = pair[1];
-
-      ERL_NIF_TERM adding_header_values;
-      if (enif_get_map_value(env, headers, header_name,
-            &adding_header_values)) {
-        if (!enif_is_list(env, adding_header_values)) {
-          return enif_make_tuple2(env, enif_make_atom(env, "error"),
-              enif_make_atom(env, "multiple_definition"));
-        }
-        enif_make_reverse_list(env, adding_header_values,
-            &adding_header_values);
-        ERL_NIF_TERM head, tail = header_values;
-        while (enif_get_list_cell(env, tail, &head, &tail)) {
-          adding_header_values = enif_make_list_cell(env, head,
-              adding_header_values);
-        }
-        enif_make_reverse_list(env, adding_header_values,
-            &adding_header_values);
-      } else {
-        adding_header_values = header_values;
-      }
-      enif_make_map_put(env, headers, header_name, adding_header_values,
-          &headers);
+    if (enif_get_tuple(env, header, &arity, &pair) && arity == 2
+        && !headers.Add(index, StringPiece(it.name_begin(), it.name_end()),
+               pair[0], pair[1],
+               StringPiece(it.name_begin(), it.values_end()))) {
+      return enif_make_tuple2(env, MakeAtom(ATOM_error),
+          MakeAtom(ATOM_multiple_definition));
     }
   }
 
-  enif_make_reverse_list(env, headers, &headers);
+  size_t body_size = has_body ? length - body_offset : 0;
+  if (options.datagram && has_content_length) {
+    ERL_NIF_TERM value = kParsers[HEADER_content_length](env,
+        content_length.begin(), content_length.end());
+    int size;
+    if (!enif_get_int(env, value, &size) || size < 0)
+      return enif_make_tuple2(env, MakeAtom(ATOM_error),
+          MakeAtom(ATOM_invalid_content_length));
+    if (static_cast<size_t>(size) > body_size)
+      return enif_make_tuple2(env, MakeAtom(ATOM_error),
+          MakeAtom(ATOM_truncated_body));
+    body_size = size;
+  }
 
-  enif_make_map_put(env, message, enif_make_atom(env, "headers"), headers,
+  // The body is never copied, as it makes up most of the message.
+  ERL_NIF_TERM body = has_body
+      ? enif_make_sub_binary(env, binary, body_offset, body_size)
+      : MakeAtom(ATOM_nil);
+
+  ERL_NIF_TERM raw_headers = MakeAtom(ATOM_nil);
+  ERL_NIF_TERM keys[] = {
+    MakeAtom(ATOM_start_line),
+    MakeAtom(ATOM_headers),
+    MakeAtom(ATOM_body),
+    MakeAtom(ATOM_raw_headers),
+  };
+  ERL_NIF_TERM values[] = {
+    start_line,
+    headers.Build(options.raw_headers ? &source : nullptr, &raw_headers),
+    body,
+    raw_headers,
+  };
+  ERL_NIF_TERM message;
+  enif_make_map_from_arrays(env, keys, values, options.raw_headers ? 4 : 3,
       &message);
 
-  return enif_make_tuple2(env, enif_make_atom(env, "ok"), message);
+  return enif_make_tuple2(env, MakeAtom(ATOM_ok), message);
 }
 
-void LoadMethodAtoms(ErlNifEnv* env) {
-#define SIP_METHOD(x) \
-  enif_make_atom(env, ToLowerASCII(#x).c_str());
-#include "method_list.h"
-#undef SIP_METHOD
+typedef ERL_NIF_TERM (*NifFunction)(ErlNifEnv* env, int argc,
+                                    const ERL_NIF_TERM argv[]);
+
+// The share of the timeslice taken by parsing |size| bytes on a normal
+// scheduler.
+int TimeslicePercent(size_t size) {
+  return static_cast<int>(
+      std::min<size_t>(1 + size * 100 / kMaxNormalSchedulerSize, 100));
 }
 
-void LoadHeaderNameAtoms(ErlNifEnv* env) {
-  ERL_NIF_TERM atom;
-#define X(header_name, compact_name, atom_name, format) \
-  atom = enif_make_atom(env, #atom_name); \
-  g_parsers.insert(std::make_pair(atom, &Parse##format)); \
-  if (compact_name != 0) \
-    g_aliases.insert(std::make_pair(compact_name, atom));
-#include "header_list.h"
-#undef X
+// Parses |binary| if it is small enough for a normal scheduler, otherwise
+// reschedules |self| with the same arguments on a dirty CPU scheduler.
+ERL_NIF_TERM ScheduleParse(ErlNifEnv* env, ERL_NIF_TERM binary,
+    const ParseOptions& options, NifFunction self, int argc,
+    const ERL_NIF_TERM argv[]) {
+  ParseScratch scratch;
+  if (enif_thread_type() != ERL_NIF_THR_NORMAL_SCHEDULER)
+    return Parse(env, binary, options, &scratch);
+
+  ErlNifBinary bin;
+  enif_inspect_binary(env, binary, &bin);
+  if (bin.size > kMaxNormalSchedulerSize) {
+    // The dirty job is given |binary|, so that iodata is not joined twice.
+    ERL_NIF_TERM args[2];
+    std::copy(argv, argv + argc, args);
+    args[0] = binary;
+    return enif_schedule_nif(env, "parse", ERL_NIF_DIRTY_JOB_CPU_BOUND,
+        self, argc, args);
+  }
+
+  ERL_NIF_TERM result = Parse(env, binary, options, &scratch);
+  enif_consume_timeslice(env, TimeslicePercent(bin.size));
+  return result;
 }
 
-void LoadProtocolAtoms(ErlNifEnv* env) {
-#define SIP_PROTOCOL(x) \
-  enif_make_atom(env, ToLowerASCII(#x).c_str());
-#include "protocol_list.h"
-#undef SIP_PROTOCOL
+// Runs |work| on the calling scheduler, reporting the share of the timeslice
+// taken by |size| bytes, unless it is too large for a normal scheduler, in
+// which case |self| is rescheduled with the same arguments on a dirty CPU
+// scheduler, as ScheduleParse() does.
+template <typename Work>
+ERL_NIF_TERM ScheduleBySize(ErlNifEnv* env, size_t size, const char* name,
+    NifFunction self, int argc, const ERL_NIF_TERM argv[], Work work) {
+  if (enif_thread_type() != ERL_NIF_THR_NORMAL_SCHEDULER)
+    return work();
+  if (size > kMaxNormalSchedulerSize) {
+    return enif_schedule_nif(env, name, ERL_NIF_DIRTY_JOB_CPU_BOUND, self,
+        argc, argv);
+  }
+  ERL_NIF_TERM result = work();
+  enif_consume_timeslice(env, TimeslicePercent(size));
+  return result;
 }
 
-}  // namespace
+// Parses the binaries in |list|, prepending each result to |results|. When
+// the timeslice is over, or when a message is too large for a normal
+// scheduler, |self| is rescheduled with the remaining messages. Once on a
+// dirty CPU scheduler, all the remaining messages are parsed there.
+ERL_NIF_TERM ParseMany(ErlNifEnv* env, NifFunction self, ERL_NIF_TERM list,
+    ERL_NIF_TERM results) {
+  ParseOptions options;
+  ParseScratch scratch;
+  bool dirty = enif_thread_type() != ERL_NIF_THR_NORMAL_SCHEDULER;
+  ERL_NIF_TERM head, tail;
+  while (enif_get_list_cell(env, list, &head, &tail)) {
+    ErlNifBinary bin;
+    enif_inspect_binary(env, head, &bin);
+    if (!dirty && bin.size > kMaxNormalSchedulerSize) {
+      ERL_NIF_TERM args[] = {list, results};
+      return enif_schedule_nif(env, "parse_many",
+          ERL_NIF_DIRTY_JOB_CPU_BOUND, self, 2, args);
+    }
 
-extern "C" {
+    ERL_NIF_TERM result = Parse(env, head, options, &scratch);
+    if (enif_is_atom(env, result))
+      result = enif_make_tuple2(env, MakeAtom(ATOM_error), result);
+    results = enif_make_list_cell(env, result, results);
+    list = tail;
+
+    if (!dirty
+        && enif_consume_timeslice(env, TimeslicePercent(bin.size))
+        && !enif_is_empty_list(env, list)) {
+      ERL_NIF_TERM args[] = {list, results};
+      return enif_schedule_nif(env, "parse_many", 0, self, 2, args);
+    }
+  }
+  enif_make_reverse_list(env, results, &results);
+  return results;
+}
 
-static ERL_NIF_TERM parse_wrapper(ErlNifEnv* env, int argc,
-    const ERL_NIF_TERM argv[]) {
-  if (argc != 1) {
-    return enif_make_badarg(env);
-  } else if (enif_is_binary(env, argv[0])) {
-    ErlNifBinary bin;
-    enif_inspect_binary(env, argv[0], &bin);
-    return Parse(env, reinterpret_cast<const char*>(bin.data),
-        static_cast<size_t>(bin.size));
-  } else {
-    return enif_make_badarg(env);
+// Sets |*binary| to the message given as |iodata|. Binaries are parsed in
+// place; a list of binaries, such as the chunks read from a socket, is
+// joined with a single copy, and other iodata is flattened by the runtime.
+bool GetInputBinary(ErlNifEnv* env, ERL_NIF_TERM iodata,
+    ERL_NIF_TERM* binary) {
+  if (enif_is_binary(env, iodata)) {
+    *binary = iodata;
+    return true;
+  }
+  if (!enif_is_list(env, iodata))
+    return false;
+
+  ErlNifIOVec vec;
+  ErlNifIOVec* iovec = &vec;
+  ERL_NIF_TERM tail;
+  if (enif_inspect_iovec(env, std::numeric_limits<size_t>::max(), iodata,
+          &tail, &iovec)) {
+    unsigned char* data = enif_make_new_binary(env, iovec->size, binary);
+    for (int i = 0; i < iovec->iovcnt; ++i) {
+      memcpy(data, iovec->iov[i].iov_base, iovec->iov[i].iov_len);
+      data += iovec->iov[i].iov_len;
+    }
+    return true;
+  }
+
+  ErlNifBinary bin;
+  if (!enif_inspect_iolist_as_binary(env, iodata, &bin))
+    return false;
+  unsigned char* data = enif_make_new_binary(env, bin.size, binary);
+  if (bin.size != 0)
+    memcpy(data, bin.data, bin.size);
+  return true;
+}
+
+// Whether |list| is a proper list of binaries.
+bool IsBinaryList(ErlNifEnv* env, ERL_NIF_TERM list) {
+  ERL_NIF_TERM head;
+  while (enif_get_list_cell(env, list, &head, &list)) {
+    if (!enif_is_binary(env, head))
+      return false;
   }
+  return enif_is_empty_list(env, list);
 }
 
-int on_load(ErlNifEnv* env, void** priv_data, ERL_NIF_TERM load_info) {
-  LoadMethodAtoms(env);
-  LoadHeaderNameAtoms(env);
-  LoadProtocolAtoms(env);
-  return 0;
+// A header line of a LazyMessage, not decoded yet.
+struct LazyHeader {
+  // HEADER_COUNT if the header is not listed in header_list.h.
+  HeaderIndex index;
+  StringPiece name;
+  StringPiece values;
+};
+
+// A message parsed by parse_lazy/1. Only the start line is decoded up front;
+// the header lines are just indexed, and decoded when first accessed.
+struct LazyMessage {
+  LazyMessage() : env(enif_alloc_env()), start_line(0) {}
+  ~LazyMessage() {
+    enif_free_env(env);
+  }
+
+  // Holds the input binary, the start line and the decoded headers.
+  ErlNifEnv* env;
+  // The input with its continuation lines joined, if it had any.
+  std::string assembled;
+  ERL_NIF_TERM start_line;
+  std::vector<LazyHeader> headers;
+  // The {:ok, values} or {:error, reason} result of each header, valid once
+  // its bit in |is_decoded| is set. Both are guarded by |mutex|.
+  ERL_NIF_TERM decoded[HEADER_COUNT];
+  std::bitset<HEADER_COUNT> is_decoded;
+  std::mutex mutex;
+};
+
+void DestroyLazyMessage(ErlNifEnv* env, void* obj) {
+  static_cast<LazyMessage*>(obj)->~LazyMessage();
+}
+
+ERL_NIF_TERM ParseLazy(ErlNifEnv* env, ERL_NIF_TERM binary) {
+  ScopedArena scoped_arena;
+  void* obj = enif_alloc_resource(g_priv->lazy_message_type,
+      sizeof(LazyMessage));
+  LazyMessage* message = new (obj) LazyMessage();
+  ERL_NIF_TERM resource = enif_make_resource(env, message);
+  enif_release_resource(message);
+
+  // The header values will point into this copy, which is kept alive by the
+  // resource environment.
+  ERL_NIF_TERM input_binary = enif_make_copy(message->env, binary);
+  ErlNifBinary bin;
+  enif_inspect_binary(message->env, input_binary, &bin);
+
+  ParseOptions options;
+  std::vector<InputSegment> segments;
+  InputBinary source(input_binary, bin.size, options, &segments);
+  size_t headers_length, body_offset;
+  SplitBody(reinterpret_cast<const char*>(bin.data), bin.size,
+      &headers_length, &body_offset);
+
+  StringPiece input;
+  if (!PrepareInput(reinterpret_cast<const char*>(bin.data), headers_length,
+          &message->assembled, &source, &input)) {
+    return enif_make_tuple2(env, MakeAtom(ATOM_error),
+        MakeAtom(ATOM_invalid_line_break));
+  }
+
+  StringPiece::const_iterator i;
+  message->start_line = ParseStartLine(message->env, input, &i);
+  if (enif_is_atom(message->env, message->start_line)) {
+    return enif_make_tuple2(env, MakeAtom(ATOM_error),
+        message->start_line);
+  }
+
+  HeadersIterator it(i, input.end(), "\r\n");
+  while (it.GetNext()) {
+    LazyHeader header;
+    header.name = StringPiece(it.name_begin(), it.name_end());
+    header.values = StringPiece(it.values_begin(), it.values_end());
+    if (!LookupHeader(header.name, &header.index))
+      header.index = HEADER_COUNT;
+    message->headers.push_back(header);
+  }
+
+  return enif_make_tuple2(env, MakeAtom(ATOM_ok), resource);
+}
+
+// Reads a header name given the same way as the keys of the headers map
+// returned by parse/1: an atom for the headers listed in header_list.h, or
+// the name as it appears in the message for the others.
+bool GetHeaderKey(ErlNifEnv* env, ERL_NIF_TERM name, HeaderIndex* index,
+    StringPiece* unknown_name) {
+  *index = HEADER_COUNT;
+  if (enif_is_atom(env, name)) {
+    for (int i = 0; i < HEADER_COUNT; ++i) {
+      if (enif_is_identical(name, g_priv->header_atoms[i])) {
+        *index = static_cast<HeaderIndex>(i);
+        break;
+      }
+    }
+    return true;
+  }
+  ErlNifBinary bin;
+  if (!enif_inspect_binary(env, name, &bin))
+    return false;
+  *unknown_name = StringPiece(reinterpret_cast<const char*>(bin.data),
+      bin.size);
+  return true;
+}
+
+bool MatchesHeaderKey(const LazyHeader& header, HeaderIndex index,
+    StringPiece unknown_name) {
+  if (index != HEADER_COUNT)
+    return header.index == index;
+  return header.index == HEADER_COUNT && !unknown_name.empty()
+      && header.name == unknown_name;
+}
+
+// Decodes all the lines of the header |index| into |message->env|.
+ERL_NIF_TERM DecodeHeader(LazyMessage* message, HeaderIndex index) {
+  ScopedArena scoped_arena;
+  ErlNifEnv* env = message->env;
+  std::vector<ERL_NIF_TERM> lists;
+  for (const LazyHeader& header : message->headers) {
+    if (header.index != index)
+      continue;
+    ERL_NIF_TERM parsed = kParsers[index](env, header.values.begin(),
+        header.values.end());
+    if (enif_is_atom(env, parsed))
+      return enif_make_tuple2(env, MakeAtom(ATOM_error), parsed);
+    if (!lists.empty() && !enif_is_list(env, lists[0])) {
+      return enif_make_tuple2(env, MakeAtom(ATOM_error),
+          MakeAtom(ATOM_multiple_definition));
+    }
+    lists.push_back(parsed);
+  }
+  if (lists.empty())
+    return MakeAtom(ATOM_error);
+  std::vector<ERL_NIF_TERM> elements;
+  return enif_make_tuple2(env, MakeAtom(ATOM_ok),
+      JoinHeaderValues(env, lists.data(), lists.size(), &elements));
+}
+
+// The size of the header lines GetHeader() has to go through: none if the
+// header was decoded already.
+size_t PendingHeaderSize(LazyMessage* message, HeaderIndex index,
+    StringPiece unknown_name) {
+  if (index != HEADER_COUNT) {
+    std::lock_guard<std::mutex> lock(message->mutex);
+    if (message->is_decoded[index])
+      return 0;
+  }
+  size_t size = 0;
+  for (const LazyHeader& header : message->headers) {
+    if (MatchesHeaderKey(header, index, unknown_name))
+      size += header.values.size();
+  }
+  return size;
+}
+
+ERL_NIF_TERM GetHeader(ErlNifEnv* env, LazyMessage* message,
+    HeaderIndex index, StringPiece unknown_name) {
+  if (index != HEADER_COUNT) {
+    std::lock_guard<std::mutex> lock(message->mutex);
+    if (!message->is_decoded[index]) {
+      message->decoded[index] = DecodeHeader(message, index);
+      message->is_decoded.set(index);
+    }
+    return enif_make_copy(env, message->decoded[index]);
+  }
+
+  // Other headers are returned as they are, so there is nothing to cache.
+  ERL_NIF_TERM values = enif_make_list(env, 0);
+  bool found = false;
+  for (const LazyHeader& header : message->headers) {
+    if (MatchesHeaderKey(header, index, unknown_name)) {
+      values = enif_make_list_cell(env, MakeString(env, header.values),
+          values);
+      found = true;
+    }
+  }
+  if (!found)
+    return MakeAtom(ATOM_error);
+  enif_make_reverse_list(env, values, &values);
+  return enif_make_tuple2(env, MakeAtom(ATOM_ok), values);
+}
+
+ERL_NIF_TERM GetRawHeader(ErlNifEnv* env, LazyMessage* message,
+    HeaderIndex index, StringPiece unknown_name) {
+  ERL_NIF_TERM values = enif_make_list(env, 0);
+  for (const LazyHeader& header : message->headers) {
+    if (MatchesHeaderKey(header, index, unknown_name)) {
+      values = enif_make_list_cell(env, MakeString(env, header.values),
+          values);
+    }
+  }
+  enif_make_reverse_list(env, values, &values);
+  return values;
+}
+
+ERL_NIF_TERM GetHeaderNames(ErlNifEnv* env, LazyMessage* message) {
+  bool seen[HEADER_COUNT] = {};
+  std::vector<StringPiece> unknown_names;
+  ERL_NIF_TERM names = enif_make_list(env, 0);
+  for (const LazyHeader& header : message->headers) {
+    ERL_NIF_TERM name;
+    if (header.index != HEADER_COUNT) {
+      if (seen[header.index])
+        continue;
+      seen[header.index] = true;
+      name = g_priv->header_atoms[header.index];
+    } else {
+      if (std::find(unknown_names.begin(), unknown_names.end(), header.name)
+            != unknown_names.end())
+        continue;
+      unknown_names.push_back(header.name);
+      name = MakeString(env, header.name);
+    }
+    names = enif_make_list_cell(env, name, names);
+  }
+  enif_make_reverse_list(env, names, &names);
+  return names;
+}
+
+bool GetLazyMessage(ErlNifEnv* env, ERL_NIF_TERM term,
+    LazyMessage** message) {
+  return enif_get_resource(env, term, g_priv->lazy_message_type,
+      reinterpret_cast<void**>(message));
+}
+
+// The framer of a stream connection. It is normally used by the single
+// process reading the connection, but nothing prevents sharing it.
+struct Framer {
+  explicit Framer(size_t max_message_size)
+    : framer(max_message_size) {
+  }
+
+  StreamFramer framer;
+  FramedChunk chunk;
+  std::mutex mutex;
+};
+
+void DestroyFramer(ErlNifEnv* env, void* obj) {
+  static_cast<Framer*>(obj)->~Framer();
+}
+
+ERL_NIF_TERM NewFramer(ErlNifEnv* env, size_t max_message_size) {
+  void* obj = enif_alloc_resource(g_priv->framer_type, sizeof(Framer));
+  Framer* framer = new (obj) Framer(max_message_size);
+  ERL_NIF_TERM resource = enif_make_resource(env, framer);
+  enif_release_resource(framer);
+  return resource;
+}
+
+AtomIndex FramerError(FramerStatus status) {
+  switch (status) {
+    case FRAMER_MESSAGE_TOO_LARGE:
+      return ATOM_message_too_large;
+    case FRAMER_MISSING_CONTENT_LENGTH:
+      return ATOM_missing_content_length;
+    default:
+      return ATOM_invalid_content_length;
+  }
+}
+
+// Feeds |chunk| to the framer, returning the messages it completes. The
+// messages lying entirely within |chunk| are returned as sub-binaries of it;
+// only a message spanning several chunks is copied.
+ERL_NIF_TERM FrameChunk(ErlNifEnv* env, Framer* framer, ERL_NIF_TERM chunk) {
+  ErlNifBinary bin;
+  enif_inspect_binary(env, chunk, &bin);
+
+  std::lock_guard<std::mutex> lock(framer->mutex);
+  FramedChunk* result = &framer->chunk;
+  FramerStatus status = framer->framer.Feed(
+      reinterpret_cast<const char*>(bin.data), bin.size, result);
+  if (status != FRAMER_OK) {
+    return enif_make_tuple2(env, MakeAtom(ATOM_error),
+        MakeAtom(FramerError(status)));
+  }
+
+  ERL_NIF_TERM messages = enif_make_list(env, 0);
+  for (auto it = result->messages.rbegin(); it != result->messages.rend();
+       ++it) {
+    messages = enif_make_list_cell(env,
+        enif_make_sub_binary(env, chunk, it->first, it->second), messages);
+  }
+  if (!result->buffered_message.empty()) {
+    ERL_NIF_TERM message;
+    unsigned char* data = enif_make_new_binary(env,
+        result->buffered_message.size(), &message);
+    std::memcpy(data, result->buffered_message.data(),
+        result->buffered_message.size());
+    messages = enif_make_list_cell(env, message, messages);
+  }
+
+  if (enif_thread_type() == ERL_NIF_THR_NORMAL_SCHEDULER)
+    enif_consume_timeslice(env, TimeslicePercent(bin.size));
+  return enif_make_tuple3(env, MakeAtom(ATOM_ok), messages,
+      enif_make_int(env, result->keepalives));
+}
+
+bool GetFramer(ErlNifEnv* env, ERL_NIF_TERM term, Framer** framer) {
+  return enif_get_resource(env, term, g_priv->framer_type,
+      reinterpret_cast<void**>(framer));
+}
+
+// Reads the new_framer/1 options, given as a keyword list.
+bool GetFramerOptions(ErlNifEnv* env, ERL_NIF_TERM list,
+    size_t* max_message_size) {
+  ERL_NIF_TERM head;
+  while (enif_get_list_cell(env, list, &head, &list)) {
+    int arity;
+    const ERL_NIF_TERM* pair;
+    if (!enif_get_tuple(env, head, &arity, &pair) || arity != 2)
+      return false;
+    unsigned long size;
+    if (enif_is_identical(pair[0], MakeAtom(ATOM_max_message_size))
+        && enif_get_ulong(env, pair[1], &size)) {
+      *max_message_size = size;
+    } else {
+      return false;
+    }
+  }
+  return enif_is_empty_list(env, list);
+}
+
+// Reads a list of header atoms, as the keys of the headers map.
+bool GetSelectedHeaders(ErlNifEnv* env, ERL_NIF_TERM list,
+    std::bitset<HEADER_COUNT>* selected_headers) {
+  ERL_NIF_TERM head;
+  while (enif_get_list_cell(env, list, &head, &list)) {
+    int i = 0;
+    while (i < HEADER_COUNT
+           && !enif_is_identical(head, g_priv->header_atoms[i]))
+      ++i;
+    if (i == HEADER_COUNT)
+      return false;
+    selected_headers->set(i);
+  }
+  return enif_is_empty_list(env, list);
+}
+
+bool GetBoolean(ErlNifEnv* env, ERL_NIF_TERM term, bool* value) {
+  if (enif_is_identical(term, MakeAtom(ATOM_true)))
+    *value = true;
+  else if (enif_is_identical(term, MakeAtom(ATOM_false)))
+    *value = false;
+  else
+    return false;
+  return true;
+}
+
+// Reads the parse/2 options, given as a keyword list.
+bool GetParseOptions(ErlNifEnv* env, ERL_NIF_TERM list,
+    ParseOptions* options) {
+  ERL_NIF_TERM head;
+  while (enif_get_list_cell(env, list, &head, &list)) {
+    int arity;
+    const ERL_NIF_TERM* pair;
+    if (!enif_get_tuple(env, head, &arity, &pair) || arity != 2)
+      return false;
+    unsigned long size;
+    if (enif_is_identical(pair[0], MakeAtom(ATOM_sub_binaries))) {
+      if (!GetBoolean(env, pair[1], &options->sub_binaries))
+        return false;
+    } else if (enif_is_identical(pair[0],
+                   MakeAtom(ATOM_min_sub_binary_size))) {
+      if (!enif_get_ulong(env, pair[1], &size))
+        return false;
+      options->min_sub_binary_size = size;
+    } else if (enif_is_identical(pair[0],
+                   MakeAtom(ATOM_max_pinned_size))) {
+      if (!enif_get_ulong(env, pair[1], &size))
+        return false;
+      options->max_pinned_size = size;
+    } else if (enif_is_identical(pair[0], MakeAtom(ATOM_only))) {
+      if (!GetSelectedHeaders(env, pair[1], &options->selected_headers))
+        return false;
+      options->only_selected_headers = true;
+    } else if (enif_is_identical(pair[0], MakeAtom(ATOM_datagram))) {
+      if (!GetBoolean(env, pair[1], &options->datagram))
+        return false;
+    } else if (enif_is_identical(pair[0], MakeAtom(ATOM_inet_addresses))) {
+      if (!GetBoolean(env, pair[1], &options->inet_addresses))
+        return false;
+    } else if (enif_is_identical(pair[0], MakeAtom(ATOM_uris))) {
+      if (!GetBoolean(env, pair[1], &options->uris))
+        return false;
+    } else if (enif_is_identical(pair[0], MakeAtom(ATOM_raw_headers))) {
+      if (!GetBoolean(env, pair[1], &options->raw_headers))
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return enif_is_empty_list(env, list);
+}
+
+// Messages are serialized twice by the same writers: first into a
+// SizeCounter, to allocate the output binary at its final size, and then
+// into a BufferWriter, filling it in a single pass.
+class SizeCounter {
+ public:
+  SizeCounter() : size_(0) {}
+
+  void Append(StringPiece s) { size_ += s.size(); }
+  void Append(char c) { ++size_; }
+
+  size_t size() const { return size_; }
+
+ private:
+  size_t size_;
+};
+
+class BufferWriter {
+ public:
+  explicit BufferWriter(unsigned char* data)
+    : current_(reinterpret_cast<char*>(data)) {
+  }
+
+  void Append(StringPiece s) {
+    if (!s.empty())
+      memcpy(current_, s.data(), s.size());
+    current_ += s.size();
+  }
+  void Append(char c) { *current_++ = c; }
+
+ private:
+  char* current_;
+};
+
+// Iterates over the pairs of a map. Sippet.Message.to_iodata/1 used to write
+// parameters and headers by prepending them, so they are written from the
+// last pair to the first one, keeping the output unchanged.
+class MapPairsIterator {
+ public:
+  MapPairsIterator(ErlNifEnv* env, ERL_NIF_TERM map, bool reverse)
+    : env_(env),
+      reverse_(reverse),
+      valid_(enif_map_iterator_create(env, map, &it_,
+                 reverse ? ERL_NIF_MAP_ITERATOR_TAIL
+                         : ERL_NIF_MAP_ITERATOR_HEAD)) {
+  }
+
+  ~MapPairsIterator() {
+    if (valid_)
+      enif_map_iterator_destroy(env_, &it_);
+  }
+
+  // Whether the iterated term is a map.
+  bool valid() const { return valid_; }
+
+  bool GetNext(ERL_NIF_TERM* key, ERL_NIF_TERM* value) {
+    if (!valid_ || !enif_map_iterator_get_pair(env_, &it_, key, value))
+      return false;
+    if (reverse_)
+      enif_map_iterator_prev(env_, &it_);
+    else
+      enif_map_iterator_next(env_, &it_);
+    return true;
+  }
+
+ private:
+  ErlNifEnv* env_;
+  bool reverse_;
+  bool valid_;
+  ErlNifMapIterator it_;
+};
+
+bool GetBinary(ErlNifEnv* env, ERL_NIF_TERM term, StringPiece* s) {
+  ErlNifBinary binary;
+  if (!enif_inspect_binary(env, term, &binary))
+    return false;
+  *s = StringPiece(reinterpret_cast<const char*>(binary.data), binary.size);
+  return true;
+}
+
+template <typename Sink>
+bool WriteBinary(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  StringPiece s;
+  if (!GetBinary(env, term, &s))
+    return false;
+  out->Append(s);
+  return true;
+}
+
+template <typename Sink>
+bool WriteInteger(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  ErlNifSInt64 value;
+  if (!enif_get_int64(env, term, &value))
+    return false;
+  char buffer[24];
+  int length = snprintf(buffer, sizeof(buffer), "%lld",
+      static_cast<long long>(value));
+  out->Append(StringPiece(buffer, length));
+  return true;
+}
+
+// Writes the shortest decimal form that reads back as the same double. The
+// stream uses the classic locale, so the decimal point is always '.', as
+// ParseDecimalDouble() expects, whatever the C locale.
+template <typename Sink>
+bool WriteDouble(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  double value;
+  if (!enif_get_double(env, term, &value))
+    return false;
+  std::ostringstream stream;
+  stream.imbue(std::locale::classic());
+  std::string result;
+  for (int precision = 1; precision <= 17; ++precision) {
+    stream.str(std::string());
+    stream.precision(precision);
+    stream << value;
+    result = stream.str();
+    double parsed;
+    if (ParseDecimalDouble(result, &parsed) && parsed == value)
+      break;
+  }
+  out->Append(result);
+  return true;
+}
+
+// Methods and protocols given as atoms are written in upper case.
+template <typename Sink>
+bool WriteAtomOrBinary(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  char name[256];
+  int length = enif_get_atom(env, term, name, sizeof(name), ERL_NIF_LATIN1);
+  if (length <= 0)
+    return WriteBinary(env, term, out);
+  for (int i = 0; i < length - 1; ++i)
+    out->Append(ToUpperASCII(name[i]));
+  return true;
+}
+
+// Writes a {major, minor} version, prefixed by "SIP/".
+template <typename Sink>
+bool WriteVersion(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* version;
+  if (!enif_get_tuple(env, term, &arity, &version) || arity != 2)
+    return false;
+  out->Append("SIP/");
+  if (!WriteInteger(env, version[0], out))
+    return false;
+  out->Append('.');
+  return WriteInteger(env, version[1], out);
+}
+
+// Parameter values with spaces, tabs or quotes are written quoted.
+template <typename Sink>
+void WriteMaybeQuoted(StringPiece value, Sink* out) {
+  if (value.find_first_of(" \t\"") == StringPiece::npos) {
+    out->Append(value);
+    return;
+  }
+  out->Append('"');
+  for (char c : value) {
+    if (c == '"')
+      out->Append('\\');
+    out->Append(c);
+  }
+  out->Append('"');
+}
+
+template <typename Sink>
+bool WriteParameters(ErlNifEnv* env, ERL_NIF_TERM map, Sink* out) {
+  MapPairsIterator it(env, map, true);
+  if (!it.valid())
+    return false;
+  ERL_NIF_TERM name, value;
+  while (it.GetNext(&name, &value)) {
+    StringPiece value_string;
+    if (!GetBinary(env, value, &value_string))
+      return false;
+    out->Append(';');
+    if (!WriteBinary(env, name, out))
+      return false;
+    if (!value_string.empty()) {
+      out->Append('=');
+      WriteMaybeQuoted(value_string, out);
+    }
+  }
+  return true;
+}
+
+bool IsQuotedAuthParam(StringPiece name) {
+  static const char* const kQuotedAuthParams[] = {
+    "username", "realm", "nonce", "uri", "response", "cnonce", "opaque",
+  };
+  for (const char* quoted : kQuotedAuthParams) {
+    if (name == quoted)
+      return true;
+  }
+  return false;
+}
+
+// Writes the "scheme params" of SchemeAndAuthParams headers.
+template <typename Sink>
+bool WriteAuthParams(ErlNifEnv* env, ERL_NIF_TERM map, Sink* out) {
+  MapPairsIterator it(env, map, false);
+  if (!it.valid())
+    return false;
+  ERL_NIF_TERM name, value;
+  bool first = true;
+  while (it.GetNext(&name, &value)) {
+    StringPiece name_string;
+    if (!GetBinary(env, name, &name_string))
+      return false;
+    if (!first)
+      out->Append(',');
+    first = false;
+    out->Append(name_string);
+    bool quoted = IsQuotedAuthParam(name_string);
+    out->Append(quoted ? "=\"" : "=");
+    if (!WriteBinary(env, value, out))
+      return false;
+    if (quoted)
+      out->Append('"');
+  }
+  return true;
+}
+
+// Writes a NaiveDateTime struct or a date tuple as returned by the parser.
+template <typename Sink>
+bool WriteDate(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int fields[6];
+  int arity;
+  const ERL_NIF_TERM* elements;
+  if (enif_get_tuple(env, term, &arity, &elements)) {
+    const ERL_NIF_TERM* date;
+    const ERL_NIF_TERM* time;
+    if (arity != 3
+        || !enif_get_tuple(env, elements[0], &arity, &date) || arity != 3
+        || !enif_get_tuple(env, elements[1], &arity, &time) || arity != 3)
+      return false;
+    for (int i = 0; i < 3; ++i) {
+      if (!enif_get_int(env, date[i], &fields[i])
+          || !enif_get_int(env, time[i], &fields[i + 3]))
+        return false;
+    }
+  } else {
+    static const AtomIndex kFields[] = {
+      ATOM_year, ATOM_month, ATOM_day, ATOM_hour, ATOM_minute, ATOM_second,
+    };
+    for (int i = 0; i < 6; ++i) {
+      ERL_NIF_TERM value;
+      if (!enif_get_map_value(env, term, MakeAtom(kFields[i]), &value)
+          || !enif_get_int(env, value, &fields[i]))
+        return false;
+    }
+  }
+
+  PRExplodedTime time = {};
+  time.tm_year = static_cast<PRInt16>(fields[0]);
+  time.tm_month = fields[1] - 1;
+  time.tm_mday = fields[2];
+  time.tm_hour = fields[3];
+  time.tm_min = fields[4];
+  time.tm_sec = fields[5];
+  char buffer[64];
+  size_t length = FormatRFC1123Date(time, buffer, sizeof(buffer));
+  if (length == 0)
+    return false;
+  out->Append(StringPiece(buffer, length));
+  return true;
+}
+
+template <typename Sink>
+using ValueWriter = bool (*)(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out);
+
+// Writes the values of a list joined by commas. A single value is written as
+// a list of one, as Sippet.Message.to_iodata/1 did.
+template <typename Sink>
+bool WriteValueList(ErlNifEnv* env, ERL_NIF_TERM term,
+    ValueWriter<Sink> write_value, Sink* out) {
+  if (!enif_is_list(env, term))
+    return write_value(env, term, out);
+  ERL_NIF_TERM head, tail = term;
+  bool first = true;
+  while (enif_get_list_cell(env, tail, &head, &tail)) {
+    if (!first)
+      out->Append(", ");
+    first = false;
+    if (!write_value(env, head, out))
+      return false;
+  }
+  return true;
+}
+
+template <typename Sink>
+bool WriteTokenParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 2
+      || !WriteBinary(env, e[0], out))
+    return false;
+  return WriteParameters(env, e[1], out);
+}
+
+template <typename Sink>
+bool WriteTypeSubtypeParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  const ERL_NIF_TERM* type;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 2
+      || !enif_get_tuple(env, e[0], &arity, &type) || arity != 2
+      || !WriteBinary(env, type[0], out))
+    return false;
+  out->Append('/');
+  if (!WriteBinary(env, type[1], out))
+    return false;
+  return WriteParameters(env, e[1], out);
+}
+
+template <typename Sink>
+bool WriteUriParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 2)
+    return false;
+  out->Append('<');
+  if (!WriteBinary(env, e[0], out))
+    return false;
+  out->Append('>');
+  return WriteParameters(env, e[1], out);
+}
+
+// Writes a name-addr, with the URI already converted to a binary.
+template <typename Sink>
+bool WriteContactParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  StringPiece display_name;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 3
+      || !GetBinary(env, e[0], &display_name))
+    return false;
+  if (!display_name.empty()) {
+    out->Append('"');
+    out->Append(display_name);
+    out->Append("\" ");
+  }
+  out->Append('<');
+  if (!WriteBinary(env, e[1], out))
+    return false;
+  out->Append('>');
+  return WriteParameters(env, e[2], out);
+}
+
+template <typename Sink>
+bool WriteWarning(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 3
+      || !WriteInteger(env, e[0], out))
+    return false;
+  out->Append(' ');
+  if (!WriteBinary(env, e[1], out))
+    return false;
+  out->Append(" \"");
+  if (!WriteBinary(env, e[2], out))
+    return false;
+  out->Append('"');
+  return true;
+}
+
+// Writes a Via, with inet address hosts already converted to binaries.
+template <typename Sink>
+bool WriteVia(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  const ERL_NIF_TERM* sent_by;
+  ErlNifSInt64 port;
+  StringPiece host;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 4
+      || !WriteVersion(env, e[0], out))
+    return false;
+  out->Append('/');
+  if (!WriteAtomOrBinary(env, e[1], out)
+      || !enif_get_tuple(env, e[2], &arity, &sent_by) || arity != 2
+      || !GetBinary(env, sent_by[0], &host) || host.empty()
+      || !enif_get_int64(env, sent_by[1], &port))
+    return false;
+  // The parser returns IPv6 references without their brackets.
+  bool bracketed = host.find(':') != StringPiece::npos && host[0] != '[';
+  out->Append(' ');
+  if (bracketed)
+    out->Append('[');
+  out->Append(host);
+  if (bracketed)
+    out->Append(']');
+  if (port > 0) {
+    out->Append(':');
+    WriteInteger(env, sent_by[1], out);
+  }
+  return WriteParameters(env, e[3], out);
+}
+
+// Writers of the header formats of header_list.h, the reverse of their
+// Parse##format functions. The values of the one per line formats are
+// written one at a time, each on its own line.
+
+template <typename Sink>
+bool WriteMultipleTypeSubtypeParams(ErlNifEnv* env, ERL_NIF_TERM term,
+    Sink* out) {
+  return WriteValueList(env, term, &WriteTypeSubtypeParams<Sink>, out);
+}
+
+template <typename Sink>
+bool WriteMultipleTokenParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteValueList(env, term, &WriteTokenParams<Sink>, out);
+}
+
+template <typename Sink>
+bool WriteMultipleUriParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteValueList(env, term, &WriteUriParams<Sink>, out);
+}
+
+template <typename Sink>
+bool WriteMultipleTokens(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteValueList(env, term, &WriteBinary<Sink>, out);
+}
+
+template <typename Sink>
+bool WriteOnlyAuthParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  MapPairsIterator it(env, term, true);
+  if (!it.valid())
+    return false;
+  ERL_NIF_TERM name, value;
+  bool first = true;
+  while (it.GetNext(&name, &value)) {
+    if (!first)
+      out->Append(", ");
+    first = false;
+    if (!WriteBinary(env, name, out))
+      return false;
+    out->Append('=');
+    if (!WriteBinary(env, value, out))
+      return false;
+  }
+  return true;
+}
+
+template <typename Sink>
+bool WriteSchemeAndAuthParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 2
+      || !WriteBinary(env, e[0], out))
+    return false;
+  out->Append(' ');
+  return WriteAuthParams(env, e[1], out);
+}
+
+template <typename Sink>
+bool WriteSingleToken(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteBinary(env, term, out);
+}
+
+template <typename Sink>
+bool WriteStarOrMultipleContactParams(ErlNifEnv* env, ERL_NIF_TERM term,
+    Sink* out) {
+  StringPiece star;
+  if (GetBinary(env, term, &star)) {
+    if (star != "*")
+      return false;
+    out->Append(star);
+    return true;
+  }
+  return WriteValueList(env, term, &WriteContactParams<Sink>, out);
+}
+
+template <typename Sink>
+bool WriteSingleTokenParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteTokenParams(env, term, out);
+}
+
+template <typename Sink>
+bool WriteSingleInteger(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteInteger(env, term, out);
+}
+
+template <typename Sink>
+bool WriteSingleTypeSubtypeParams(ErlNifEnv* env, ERL_NIF_TERM term,
+    Sink* out) {
+  return WriteTypeSubtypeParams(env, term, out);
+}
+
+template <typename Sink>
+bool WriteCseq(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 2
+      || !WriteInteger(env, e[0], out))
+    return false;
+  out->Append(' ');
+  return WriteAtomOrBinary(env, e[1], out);
+}
+
+template <typename Sink>
+bool WriteSingleContactParams(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteContactParams(env, term, out);
+}
+
+template <typename Sink>
+bool WriteMimeVersion(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 2
+      || !WriteInteger(env, e[0], out))
+    return false;
+  out->Append('.');
+  return WriteInteger(env, e[1], out);
+}
+
+template <typename Sink>
+bool WriteTrimmedUtf8(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteBinary(env, term, out);
+}
+
+template <typename Sink>
+bool WriteMultipleContactParams(ErlNifEnv* env, ERL_NIF_TERM term,
+    Sink* out) {
+  return WriteValueList(env, term, &WriteContactParams<Sink>, out);
+}
+
+// Writes a Retry-After, with an optional comment.
+template <typename Sink>
+bool WriteRetryAfter(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  int arity;
+  const ERL_NIF_TERM* e;
+  StringPiece comment;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 3
+      || !WriteInteger(env, e[0], out)
+      || !GetBinary(env, e[1], &comment))
+    return false;
+  if (!comment.empty()) {
+    out->Append(" (");
+    out->Append(comment);
+    out->Append(") ");
+  }
+  return WriteParameters(env, e[2], out);
+}
+
+// Writes a Timestamp, either already formatted by Sippet.Message or as
+// returned by the parser, without the delay when it is zero.
+template <typename Sink>
+bool WriteTimestamp(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  if (WriteBinary(env, term, out))
+    return true;
+  int arity;
+  const ERL_NIF_TERM* e;
+  double delay;
+  if (!enif_get_tuple(env, term, &arity, &e) || arity != 2
+      || !enif_get_double(env, e[1], &delay)
+      || !WriteDouble(env, e[0], out))
+    return false;
+  if (delay > 0) {
+    out->Append(' ');
+    WriteDouble(env, e[1], out);
+  }
+  return true;
+}
+
+template <typename Sink>
+bool WriteMultipleVias(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteValueList(env, term, &WriteVia<Sink>, out);
+}
+
+template <typename Sink>
+bool WriteMultipleWarnings(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  return WriteValueList(env, term, &WriteWarning<Sink>, out);
+}
+
+// Writes a value of a header not listed in header_list.h, inferring its
+// format from the shape of the term, as Sippet.Message.to_iodata/1 does.
+template <typename Sink>
+bool WriteUnknownHeaderValue(ErlNifEnv* env, ERL_NIF_TERM term, Sink* out) {
+  if (enif_is_binary(env, term))
+    return WriteBinary(env, term, out);
+  if (enif_is_number(env, term))
+    return WriteInteger(env, term, out);
+  if (enif_is_map(env, term))
+    return WriteDate(env, term, out);
+
+  int arity;
+  const ERL_NIF_TERM* e;
+  if (!enif_get_tuple(env, term, &arity, &e))
+    return false;
+
+  switch (arity) {
+    case 2:
+      if (enif_is_number(env, e[0]) && !enif_is_number(env, e[1]))
+        return WriteCseq(env, term, out);
+      if (enif_is_number(env, e[0])) {
+        double delay;
+        if (enif_get_double(env, e[1], &delay))
+          return WriteTimestamp(env, term, out);
+        return WriteMimeVersion(env, term, out);
+      }
+      if (enif_is_tuple(env, e[0]))
+        return WriteTypeSubtypeParams(env, term, out);
+      return WriteTokenParams(env, term, out);
+    case 3:
+      if (enif_is_tuple(env, e[0]))
+        return WriteDate(env, term, out);
+      if (enif_is_binary(env, e[0]))
+        return WriteContactParams(env, term, out);
+      if (enif_is_map(env, e[2]))
+        return WriteRetryAfter(env, term, out);
+      return WriteWarning(env, term, out);
+    case 4:
+      return WriteVia(env, term, out);
+    default:
+      return false;
+  }
+}
+
+// Writes a header value in the format of its header, or inferring it from
+// the shape of the term for headers not listed in header_list.h.
+template <typename Sink>
+bool WriteHeaderValue(ErlNifEnv* env, HeaderIndex index, ERL_NIF_TERM term,
+    Sink* out) {
+  static const ValueWriter<Sink> kWriters[] = {
+#define X(header_name, compact_form, atom_name, format) \
+    &Write##format<Sink>,
+#include "header_list.h"
+#undef X
+  };
+  if (index == HEADER_COUNT)
+    return WriteValueList(env, term, &WriteUnknownHeaderValue<Sink>, out);
+  return kWriters[index](env, term, out);
+}
+
+// Writes a header, using its compact form if |compact| and it has one.
+template <typename Sink>
+bool WriteHeader(ErlNifEnv* env, ERL_NIF_TERM key, ERL_NIF_TERM value,
+    bool compact, Sink* out) {
+  HeaderIndex index;
+  StringPiece name;
+  if (!GetHeaderKey(env, key, &index, &name))
+    return false;
+  char compact_form = 0;
+  if (index != HEADER_COUNT) {
+    name = HeaderName(index);
+    if (compact)
+      compact_form = HeaderCompactForm(index);
+    if (compact_form != 0)
+      name = StringPiece(&compact_form, 1);
+  } else if (enif_is_atom(env, key)) {
+    return false;
+  }
+
+  if (index != HEADER_COUNT && IsOnePerLineHeader(index)) {
+    ERL_NIF_TERM head, tail = value;
+    if (!enif_is_list(env, value))
+      tail = enif_make_list1(env, value);
+    while (enif_get_list_cell(env, tail, &head, &tail)) {
+      out->Append(name);
+      out->Append(": ");
+      if (!WriteHeaderValue(env, index, head, out))
+        return false;
+      out->Append("\r\n");
+    }
+    return true;
+  }
+
+  out->Append(name);
+  out->Append(": ");
+  if (!WriteHeaderValue(env, index, value, out))
+    return false;
+  out->Append("\r\n");
+  return true;
+}
+
+// Writes the original lines of a header if its value is still the one they
+// were parsed into, as recorded by the raw_headers option of parse/2.
+// Returns false if the header has to be written from its value.
+template <typename Sink>
+bool WriteRawHeader(ErlNifEnv* env, ERL_NIF_TERM raw_headers,
+    ERL_NIF_TERM key, ERL_NIF_TERM value, Sink* out) {
+  ERL_NIF_TERM raw;
+  int arity;
+  const ERL_NIF_TERM* pair;
+  if (!enif_get_map_value(env, raw_headers, key, &raw)
+      || !enif_get_tuple(env, raw, &arity, &pair) || arity != 2
+      || enif_compare(value, pair[0]) != 0)
+    return false;
+  ERL_NIF_TERM head, tail = pair[1];
+  while (enif_get_list_cell(env, tail, &head, &tail)) {
+    if (!enif_is_binary(env, head))
+      return false;
+  }
+  tail = pair[1];
+  while (enif_get_list_cell(env, tail, &head, &tail)) {
+    WriteBinary(env, head, out);
+    out->Append("\r\n");
+  }
+  return true;
+}
+
+template <typename Sink>
+bool WriteStartLine(ErlNifEnv* env, ERL_NIF_TERM start_line, Sink* out) {
+  ERL_NIF_TERM version, method, request_uri, status_code, reason_phrase;
+  if (!enif_get_map_value(env, start_line, MakeAtom(ATOM_version), &version))
+    return false;
+  if (enif_get_map_value(env, start_line, MakeAtom(ATOM_method), &method)) {
+    if (!enif_get_map_value(env, start_line, MakeAtom(ATOM_request_uri),
+            &request_uri)
+        || !WriteAtomOrBinary(env, method, out))
+      return false;
+    out->Append(' ');
+    if (!WriteBinary(env, request_uri, out))
+      return false;
+    out->Append(' ');
+    return WriteVersion(env, version, out);
+  }
+  if (!enif_get_map_value(env, start_line, MakeAtom(ATOM_status_code),
+          &status_code)
+      || !enif_get_map_value(env, start_line, MakeAtom(ATOM_reason_phrase),
+             &reason_phrase)
+      || !WriteVersion(env, version, out))
+    return false;
+  out->Append(' ');
+  if (!WriteInteger(env, status_code, out))
+    return false;
+  out->Append(' ');
+  return WriteBinary(env, reason_phrase, out);
+}
+
+// |raw_headers| is nil if the message was not parsed with the raw_headers
+// option.
+template <typename Sink>
+bool WriteMessage(ErlNifEnv* env, ERL_NIF_TERM start_line,
+    ERL_NIF_TERM headers, ERL_NIF_TERM raw_headers, StringPiece body,
+    bool compact, Sink* out) {
+  if (!WriteStartLine(env, start_line, out))
+    return false;
+  out->Append("\r\n");
+  MapPairsIterator it(env, headers, true);
+  if (!it.valid())
+    return false;
+  ERL_NIF_TERM key, value;
+  bool has_raw_headers = enif_is_map(env, raw_headers);
+  while (it.GetNext(&key, &value)) {
+    if (has_raw_headers
+        && WriteRawHeader(env, raw_headers, key, value, out))
+      continue;
+    if (!WriteHeader(env, key, value, compact, out))
+      return false;
+  }
+  out->Append("\r\n");
+  out->Append(body);
+  return true;
+}
+
+// RFC 3261, section 18.1.1: requests within this many bytes of the path MTU
+// must be sent over a congestion controlled transport.
+const size_t kMtuMargin = 200;
+
+struct SerializeOptions {
+  SerializeOptions() : mtu(0) {}
+
+  // The path MTU of the datagram transport the message is sent over, or 0 if
+  // the message size is not limited.
+  size_t mtu;
+};
+
+// Serializes a message map, either a Sippet.Message struct or the map
+// returned by parse/1, into a single binary. A Content-Length header is
+// added if missing, with the size of the body in bytes. Headers not changed
+// since the message was parsed with the raw_headers option are copied from
+// their original lines.
+//
+// With a MTU, compact header forms are used when the message would not fit
+// in it with full forms, and the result tells whether the message needs a
+// stream transport even so.
+ERL_NIF_TERM Serialize(ErlNifEnv* env, ERL_NIF_TERM message,
+    const SerializeOptions& options) {
+  ERL_NIF_TERM start_line, headers, body;
+  if (!enif_get_map_value(env, message, MakeAtom(ATOM_start_line),
+          &start_line)
+      || !enif_get_map_value(env, message, MakeAtom(ATOM_headers), &headers)
+      || !enif_get_map_value(env, message, MakeAtom(ATOM_body), &body)
+      || !enif_is_map(env, headers))
+    return enif_make_badarg(env);
+  ERL_NIF_TERM raw_headers;
+  if (!enif_get_map_value(env, message, MakeAtom(ATOM_raw_headers),
+          &raw_headers))
+    raw_headers = MakeAtom(ATOM_nil);
+
+  ErlNifBinary body_binary;
+  StringPiece body_string;
+  if (!enif_is_identical(body, MakeAtom(ATOM_nil))) {
+    if (!enif_inspect_iolist_as_binary(env, body, &body_binary))
+      return enif_make_badarg(env);
+    body_string = StringPiece(
+        reinterpret_cast<const char*>(body_binary.data), body_binary.size);
+  }
+
+  ERL_NIF_TERM content_length_key =
+      g_priv->header_atoms[HEADER_content_length];
+  ERL_NIF_TERM content_length;
+  if (!enif_get_map_value(env, headers, content_length_key,
+          &content_length)) {
+    enif_make_map_put(env, headers, content_length_key,
+        enif_make_uint64(env, body_string.size()), &headers);
+  }
+
+  // The sizes are computed first, so that the message is written once, in
+  // the chosen form.
+  SizeCounter counter;
+  if (!WriteMessage(env, start_line, headers, raw_headers, body_string, false,
+          &counter))
+    return enif_make_badarg(env);
+  size_t size = counter.size();
+  bool compact = false;
+  bool fits = options.mtu == 0 || size + kMtuMargin <= options.mtu;
+  if (!fits) {
+    SizeCounter compact_counter;
+    WriteMessage(env, start_line, headers, raw_headers, body_string, true,
+        &compact_counter);
+    // Compact forms only pay off if the message then fits, as stream
+    // transports have no size limits.
+    if (compact_counter.size() + kMtuMargin <= options.mtu) {
+      compact = true;
+      fits = true;
+      size = compact_counter.size();
+    }
+  }
+
+  ErlNifBinary output;
+  if (!enif_alloc_binary(size, &output))
+    return MakeAtom(ATOM_no_memory);
+  BufferWriter writer(output.data);
+  WriteMessage(env, start_line, headers, raw_headers, body_string, compact,
+      &writer);
+  ERL_NIF_TERM result = enif_make_binary(env, &output);
+  if (options.mtu == 0)
+    return result;
+  return enif_make_tuple2(env,
+      MakeAtom(fits ? ATOM_ok : ATOM_needs_stream_transport), result);
+}
+
+// Reads the serialize/2 options, given as a keyword list.
+bool GetSerializeOptions(ErlNifEnv* env, ERL_NIF_TERM list,
+    SerializeOptions* options) {
+  ERL_NIF_TERM head;
+  while (enif_get_list_cell(env, list, &head, &list)) {
+    int arity;
+    const ERL_NIF_TERM* pair;
+    if (!enif_get_tuple(env, head, &arity, &pair) || arity != 2)
+      return false;
+    unsigned long mtu;
+    if (enif_is_identical(pair[0], MakeAtom(ATOM_mtu))) {
+      if (!enif_get_ulong(env, pair[1], &mtu) || mtu == 0)
+        return false;
+      options->mtu = mtu;
+    } else {
+      return false;
+    }
+  }
+  return enif_is_empty_list(env, list);
+}
+
+// A change made by edit/2: the bytes of the input binary in [begin, end) are
+// replaced by |inserted|, or just removed if it is empty.
+struct InputEdit {
+  size_t begin;
+  size_t end;
+  std::string inserted;
+};
+
+// The first line of a header, from the name to the end of the values.
+struct HeaderLine {
+  StringPiece line;
+  StringPiece values;
+};
+
+// Whether a Via sent-by |host| is the numeric |address|. Hostnames are never
+// resolved, so they always differ from it.
+bool IsSameAddress(StringPiece host, bool bracketed, StringPiece address) {
+  if (bracketed) {
+    uint16_t host_groups[8], address_groups[8];
+    return ParseIPv6Address(host, host_groups)
+        && ParseIPv6Address(address, address_groups)
+        && std::equal(host_groups, host_groups + 8, address_groups);
+  }
+  uint8_t host_bytes[4], address_bytes[4];
+  return ParseIPv4Address(host, host_bytes)
+      && ParseIPv4Address(address, address_bytes)
+      && std::equal(host_bytes, host_bytes + 4, address_bytes);
+}
+
+// Whether |address| is a numeric IPv4 or IPv6 address, the only values the
+// received parameter of RFC 3261, section 18.2.1, takes. IPv6 addresses are
+// not bracketed.
+bool IsIPAddress(StringPiece address) {
+  uint8_t bytes[4];
+  uint16_t groups[8];
+  return ParseIPv4Address(address, bytes) || ParseIPv6Address(address, groups);
+}
+
+// Applies the operations of edit/2 to a message. Header lines are located in
+// the parsed text, which is the input itself unless it has continuation
+// lines, and every change is mapped back to offsets of the input binary, so
+// that the result is made of slices of it and the inserted bytes only.
+class MessageEditor {
+ public:
+  MessageEditor(ErlNifEnv* env, ERL_NIF_TERM binary, size_t size,
+      const InputBinary& source, StringPiece input)
+    : env_(env), binary_(binary), size_(size), source_(source),
+      input_(input), popped_routes_(0) {
+  }
+
+  // Indexes the first line of each header, after the start line, and all the
+  // Route lines.
+  void FindHeaders() {
+    StringPiece::const_iterator headers_begin = SkipLineBreak(
+        FindLineEnd(input_.begin(), input_.end()), input_.end());
+    HeadersIterator it(headers_begin, input_.end(), "\r\n");
+    while (it.GetNext()) {
+      HeaderIndex index;
+      if (!LookupHeader(it.name(), &index))
+        continue;
+      HeaderLine line{StringPiece(it.name_begin(), it.values_end()),
+          it.values()};
+      if (index == HEADER_route)
+        route_lines_.push_back(line);
+      if (first_lines_[index].line.data() == nullptr)
+        first_lines_[index] = line;
+    }
+  }
+
+  // Adds a header line above the first one of the same header, or at the
+  // end of the headers if there is none.
+  void AddHeader(HeaderIndex index, StringPiece value) {
+    const HeaderLine& first = first_lines_[index];
+    StringPiece name = HeaderName(index);
+    if (first.line.data() != nullptr) {
+      Insert(first.line.begin(), name, value, "", "\r\n");
+    } else if (!input_.empty() && input_[input_.size() - 1] == '\n') {
+      Insert(input_.end(), name, value, "", "\r\n");
+    } else {
+      Insert(input_.end(), name, value, "\r\n", "");
+    }
+  }
+
+  // Adds the received and rport parameters to the top Via, as RFC 3261,
+  // section 18.2.1, and RFC 3581 require for requests: received if its
+  // sent-by host is not the source |address|, and rport if its port is not
+  // the source |port|. Parameters already there with those names are
+  // replaced. Returns false and sets |*error| to an atom on errors.
+  bool StampReceived(StringPiece address, int port, ERL_NIF_TERM* error) {
+    const HeaderLine& via = first_lines_[HEADER_via];
+    if (via.line.data() == nullptr) {
+      *error = MakeAtom(ATOM_missing_via);
+      return false;
+    }
+    ValuesIterator values(via.values.begin(), via.values.end(), ',');
+    if (!values.GetNext()) {
+      *error = MakeAtom(ATOM_missing_via);
+      return false;
+    }
+
+    Tokenizer tok(values.value_begin(), values.value_end());
+    tok.SkipTo('/');
+    tok.Skip();
+    tok.SkipTo('/');
+    tok.Skip();
+    StringPiece::const_iterator protocol_start = tok.Skip(kLWSChars);
+    StringPiece protocol(protocol_start, tok.SkipNotIn(kLWSChars));
+    StringPiece::const_iterator sentby_start = tok.Skip(kLWSChars);
+    StringPiece::const_iterator sentby_end = tok.SkipTo(';');
+    TrimLWS(&sentby_start, &sentby_end);
+    StringPiece host;
+    int via_port;
+    if (sentby_start == sentby_end
+        || !ParseHostAndPort(sentby_start, sentby_end, &host, &via_port)) {
+      *error = MakeAtom(ATOM_invalid_sentby);
+      return false;
+    }
+    if (via_port == -1)
+      via_port = DefaultViaPort(protocol);
+
+    bool add_received = !IsSameAddress(host, *sentby_start == '[', address);
+    bool add_rport = via_port != port;
+    // The parameters start at the first ';' after the sent-by, if any.
+    StringPiece::const_iterator parameters_begin = tok.current();
+    ValuesIterator parameters(parameters_begin, values.value_end(), ';');
+    while (parameters.GetNext()) {
+      StringPiece::const_iterator name_begin = parameters.value_begin();
+      StringPiece::const_iterator name_end = std::find(name_begin,
+          parameters.value_end(), '=');
+      TrimLWS(&name_begin, &name_end);
+      StringPiece name(name_begin, name_end);
+      if ((add_received && LowerCaseEqualsASCII(name, "received"))
+          || (add_rport && LowerCaseEqualsASCII(name, "rport"))) {
+        StringPiece::const_iterator semicolon = parameters.value_begin();
+        while (semicolon != parameters_begin && *semicolon != ';')
+          --semicolon;
+        Remove(semicolon, parameters.value_end());
+      }
+    }
+
+    std::string stamp;
+    if (add_received) {
+      stamp.append(";received=");
+      stamp.append(address.data(), address.size());
+    }
+    if (add_rport) {
+      stamp.append(";rport=");
+      stamp.append(std::to_string(port));
+    }
+    if (!stamp.empty())
+      Insert(values.value_end(), stamp);
+    return true;
+  }
+
+  // Removes the top Route value. Each pop removes the value following the
+  // ones already popped, and nothing once there are no values left.
+  void PopRoute() {
+    ++popped_routes_;
+  }
+
+  // Decrements Max-Forwards, or adds it with 70 if it is missing, as RFC
+  // 3261, section 16.6, requires. Returns false and sets |*error| to an
+  // atom on errors.
+  bool DecrementMaxForwards(ERL_NIF_TERM* error) {
+    const HeaderLine& max_forwards = first_lines_[HEADER_max_forwards];
+    if (max_forwards.line.data() == nullptr) {
+      AddHeader(HEADER_max_forwards, "70");
+      return true;
+    }
+    Tokenizer tok(max_forwards.values.begin(), max_forwards.values.end());
+    StringPiece::const_iterator digits_start = tok.Skip(kLWSChars);
+    StringPiece digits(digits_start, tok.SkipNotIn(kLWSChars));
+    int value;
+    if (!ParseDecimalInt(digits, &value) || value < 0) {
+      *error = MakeAtom(ATOM_invalid_digits);
+      return false;
+    }
+    if (value == 0) {
+      *error = MakeAtom(ATOM_too_many_hops);
+      return false;
+    }
+    Replace(digits.begin(), digits.end(), std::to_string(value - 1));
+    return true;
+  }
+
+  // Sets |*result| to the edited message as an iolist. Returns false if the
+  // operations changed overlapping parts of it.
+  bool Build(ERL_NIF_TERM* result) {
+    RemovePoppedRoutes();
+    // Insertions go before removals starting at the same offset, such as
+    // parameters added to the end of a line followed by a removed one.
+    std::stable_sort(edits_.begin(), edits_.end(),
+        [](const InputEdit& a, const InputEdit& b) {
+          return a.begin != b.begin ? a.begin < b.begin : a.end < b.end;
+        });
+    std::vector<ERL_NIF_TERM> slices;
+    slices.reserve(edits_.size() * 2 + 1);
+    size_t offset = 0;
+    for (const InputEdit& edit : edits_) {
+      if (edit.begin < offset)
+        return false;
+      if (edit.begin > offset) {
+        slices.push_back(enif_make_sub_binary(env_, binary_, offset,
+            edit.begin - offset));
+      }
+      if (!edit.inserted.empty()) {
+        ERL_NIF_TERM inserted;
+        unsigned char* data = enif_make_new_binary(env_,
+            edit.inserted.size(), &inserted);
+        memcpy(data, edit.inserted.data(), edit.inserted.size());
+        slices.push_back(inserted);
+      }
+      offset = edit.end;
+    }
+    if (offset < size_) {
+      slices.push_back(enif_make_sub_binary(env_, binary_, offset,
+          size_ - offset));
+    }
+    *result = enif_make_list_from_array(env_, slices.data(), slices.size());
+    return true;
+  }
+
+ private:
+  // Removes the values popped by PopRoute(), with a single edit per Route
+  // line: the popped values in front of the first remaining one, or the
+  // whole line if none remains.
+  void RemovePoppedRoutes() {
+    size_t remaining = popped_routes_;
+    for (const HeaderLine& route : route_lines_) {
+      if (remaining == 0)
+        return;
+      ValuesIterator values(route.values.begin(), route.values.end(), ',');
+      if (!values.GetNext())
+        continue;
+      StringPiece::const_iterator top_begin = values.value_begin();
+      size_t count = 1;
+      while (values.GetNext()) {
+        if (count == remaining) {
+          Remove(top_begin, values.value_begin());
+          return;
+        }
+        ++count;
+      }
+      remaining -= count;
+      // The line break preceding the line is removed along with it, as the
+      // last header line is not followed by one in the parsed text.
+      StringPiece::const_iterator line_begin = route.line.begin() - 1;
+      if (line_begin != input_.begin() && line_begin[-1] == '\r')
+        --line_begin;
+      Remove(line_begin, FindLineEnd(route.line.end(), input_.end()));
+    }
+  }
+
+  void Insert(StringPiece::const_iterator at, StringPiece name,
+      StringPiece value, const char* prefix, const char* suffix) {
+    std::string line(prefix);
+    line.append(name.data(), name.size());
+    line.append(": ");
+    line.append(value.data(), value.size());
+    line.append(suffix);
+    Insert(at, line);
+  }
+
+  void Insert(StringPiece::const_iterator at, const std::string& bytes) {
+    Replace(at, at, bytes);
+  }
+
+  void Remove(StringPiece::const_iterator begin,
+      StringPiece::const_iterator end) {
+    Replace(begin, end, std::string());
+  }
+
+  void Replace(StringPiece::const_iterator begin,
+      StringPiece::const_iterator end, const std::string& bytes) {
+    edits_.push_back(InputEdit{source_.InputOffset(begin),
+        source_.InputOffset(end), bytes});
+  }
+
+  ErlNifEnv* env_;
+  ERL_NIF_TERM binary_;
+  size_t size_;
+  const InputBinary& source_;
+  StringPiece input_;
+  HeaderLine first_lines_[HEADER_COUNT];
+  std::vector<HeaderLine> route_lines_;
+  size_t popped_routes_;
+  std::vector<InputEdit> edits_;
+};
+
+// Whether |term| is a binary that can be written as a header value, without
+// line breaks, setting |*value| to it.
+bool GetHeaderValue(ErlNifEnv* env, ERL_NIF_TERM term, StringPiece* value) {
+  return GetBinary(env, term, value)
+      && value->find_first_of("\r\n") == StringPiece::npos;
+}
+
+// Edits a message binary as a proxy forwarding it would, without decoding
+// it into terms: the header lines are only located, and the result is an
+// iolist of slices of |binary| and the inserted bytes. The operations all
+// refer to the message as received, so their order does not matter, except
+// for lines added at the same place, which are kept in order.
+ERL_NIF_TERM Edit(ErlNifEnv* env, ERL_NIF_TERM binary,
+    ERL_NIF_TERM operations) {
+  ScopedArena scoped_arena;
+  ErlNifBinary bin;
+  enif_inspect_binary(env, binary, &bin);
+  const char* raw_message = reinterpret_cast<const char*>(bin.data);
+  size_t length = static_cast<size_t>(bin.size);
+
+  size_t headers_length, body_offset;
+  SplitBody(raw_message, length, &headers_length, &body_offset);
+
+  ParseOptions options;
+  std::vector<InputSegment> segments;
+  std::string assembled;
+  InputBinary source(binary, length, options, &segments);
+  StringPiece input;
+  if (!PrepareInput(raw_message, headers_length, &assembled, &source,
+          &input)) {
+    return enif_make_tuple2(env, MakeAtom(ATOM_error),
+        MakeAtom(ATOM_invalid_line_break));
+  }
+
+  MessageEditor editor(env, binary, length, source, input);
+  editor.FindHeaders();
+  ERL_NIF_TERM head;
+  while (enif_get_list_cell(env, operations, &head, &operations)) {
+    int arity;
+    const ERL_NIF_TERM* operation;
+    StringPiece value;
+    int port;
+    bool ok = true;
+    ERL_NIF_TERM error;
+    if (enif_is_identical(head, MakeAtom(ATOM_pop_route))) {
+      editor.PopRoute();
+    } else if (enif_is_identical(head, MakeAtom(ATOM_decrement_max_forwards))) {
+      ok = editor.DecrementMaxForwards(&error);
+    } else if (!enif_get_tuple(env, head, &arity, &operation)) {
+      return enif_make_badarg(env);
+    } else if (arity == 2
+        && enif_is_identical(operation[0], MakeAtom(ATOM_add_via))
+        && GetHeaderValue(env, operation[1], &value)) {
+      editor.AddHeader(HEADER_via, value);
+    } else if (arity == 2
+        && enif_is_identical(operation[0], MakeAtom(ATOM_add_record_route))
+        && GetHeaderValue(env, operation[1], &value)) {
+      editor.AddHeader(HEADER_record_route, value);
+    } else if (arity == 3
+        && enif_is_identical(operation[0], MakeAtom(ATOM_received))
+        && GetBinary(env, operation[1], &value) && IsIPAddress(value)
+        && enif_get_int(env, operation[2], &port)
+        && port >= 0 && port <= 65535) {
+      ok = editor.StampReceived(value, port, &error);
+    } else {
+      return enif_make_badarg(env);
+    }
+    if (!ok)
+      return enif_make_tuple2(env, MakeAtom(ATOM_error), error);
+  }
+  if (!enif_is_empty_list(env, operations))
+    return enif_make_badarg(env);
+
+  ERL_NIF_TERM result;
+  if (!editor.Build(&result)) {
+    return enif_make_tuple2(env, MakeAtom(ATOM_error),
+        MakeAtom(ATOM_overlapping_edits));
+  }
+  return enif_make_tuple2(env, MakeAtom(ATOM_ok), result);
+}
+
+void LoadAtoms(ErlNifEnv* env, PrivData* priv) {
+#define SIP_ATOM(x) \
+  priv->atoms[ATOM_##x] = enif_make_atom(env, #x);
+#include "atom_list.h"
+#undef SIP_ATOM
+}
+
+void LoadMethodAtoms(ErlNifEnv* env, PrivData* priv) {
+#define SIP_METHOD(x) \
+  priv->method_atoms[METHOD_##x] = \
+      enif_make_atom(env, ToLowerASCII(#x).c_str());
+#include "method_list.h"
+#undef SIP_METHOD
+}
+
+void LoadHeaderNameAtoms(ErlNifEnv* env, PrivData* priv) {
+#define X(header_name, compact_name, atom_name, format) \
+  priv->header_atoms[HEADER_##atom_name] = enif_make_atom(env, #atom_name);
+#include "header_list.h"
+#undef X
+}
+
+void LoadProtocolAtoms(ErlNifEnv* env, PrivData* priv) {
+#define SIP_PROTOCOL(x) \
+  priv->protocol_atoms[PROTOCOL_##x] = \
+      enif_make_atom(env, ToLowerASCII(#x).c_str());
+#include "protocol_list.h"
+#undef SIP_PROTOCOL
+}
+
+// Creates the private data of the library. When upgrading, |flags| lets the
+// resource types of the new library take over the existing resources.
+int LoadPrivData(ErlNifEnv* env, void** priv_data,
+    ErlNifResourceFlags flags) {
+  PrivData* priv = static_cast<PrivData*>(enif_alloc(sizeof(PrivData)));
+  if (priv == nullptr)
+    return 1;
+  LoadAtoms(env, priv);
+  LoadMethodAtoms(env, priv);
+  LoadHeaderNameAtoms(env, priv);
+  LoadProtocolAtoms(env, priv);
+  priv->lazy_message_type = enif_open_resource_type(env, NULL,
+      "lazy_message", DestroyLazyMessage, flags, NULL);
+  priv->framer_type = enif_open_resource_type(env, NULL, "framer",
+      DestroyFramer, flags, NULL);
+  if (priv->lazy_message_type == nullptr || priv->framer_type == nullptr) {
+    enif_free(priv);
+    return 1;
+  }
+  *priv_data = priv;
+  g_priv = priv;
+  return 0;
+}
+
+}  // namespace
+
+extern "C" {
+
+static ERL_NIF_TERM parse_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  ERL_NIF_TERM binary;
+  if (argc != 1) {
+    return enif_make_badarg(env);
+  } else if (GetInputBinary(env, argv[0], &binary)) {
+    return ScheduleParse(env, binary, ParseOptions(), parse_wrapper, argc,
+        argv);
+  } else {
+    return enif_make_badarg(env);
+  }
+}
+
+static ERL_NIF_TERM parse_with_options_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  ParseOptions options;
+  ERL_NIF_TERM binary;
+  if (argc != 2
+      || !GetInputBinary(env, argv[0], &binary)
+      || !GetParseOptions(env, argv[1], &options)) {
+    return enif_make_badarg(env);
+  }
+  return ScheduleParse(env, binary, options, parse_with_options_wrapper,
+      argc, argv);
+}
+
+static ERL_NIF_TERM parse_many_continue(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  return ParseMany(env, parse_many_continue, argv[0], argv[1]);
+}
+
+static ERL_NIF_TERM parse_many_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  if (argc != 1 || !IsBinaryList(env, argv[0]))
+    return enif_make_badarg(env);
+  return ParseMany(env, parse_many_continue, argv[0], enif_make_list(env, 0));
+}
+
+static ERL_NIF_TERM parse_lazy_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  ErlNifBinary bin;
+  if (argc != 1 || !enif_inspect_binary(env, argv[0], &bin))
+    return enif_make_badarg(env);
+  return ScheduleBySize(env, bin.size, "parse_lazy", parse_lazy_wrapper,
+      argc, argv, [&] { return ParseLazy(env, argv[0]); });
+}
+
+static ERL_NIF_TERM start_line_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  LazyMessage* message;
+  if (argc != 1 || !GetLazyMessage(env, argv[0], &message))
+    return enif_make_badarg(env);
+  return enif_make_copy(env, message->start_line);
+}
+
+static ERL_NIF_TERM get_header_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  LazyMessage* message;
+  HeaderIndex index;
+  StringPiece unknown_name;
+  if (argc != 2
+      || !GetLazyMessage(env, argv[0], &message)
+      || !GetHeaderKey(env, argv[1], &index, &unknown_name))
+    return enif_make_badarg(env);
+  return ScheduleBySize(env,
+      PendingHeaderSize(message, index, unknown_name), "get_header",
+      get_header_wrapper, argc, argv,
+      [&] { return GetHeader(env, message, index, unknown_name); });
+}
+
+static ERL_NIF_TERM raw_header_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  LazyMessage* message;
+  HeaderIndex index;
+  StringPiece unknown_name;
+  if (argc != 2
+      || !GetLazyMessage(env, argv[0], &message)
+      || !GetHeaderKey(env, argv[1], &index, &unknown_name))
+    return enif_make_badarg(env);
+  return GetRawHeader(env, message, index, unknown_name);
+}
+
+static ERL_NIF_TERM header_names_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  LazyMessage* message;
+  if (argc != 1 || !GetLazyMessage(env, argv[0], &message))
+    return enif_make_badarg(env);
+  return GetHeaderNames(env, message);
+}
+
+static ERL_NIF_TERM stats_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  ERL_NIF_TERM keys[] = {
+    MakeAtom(ATOM_folded),
+    MakeAtom(ATOM_date_fallbacks),
+  };
+  ERL_NIF_TERM values[] = {
+    enif_make_uint64(env, g_folded_count.load(std::memory_order_relaxed)),
+    enif_make_uint64(env,
+        g_date_fallback_count.load(std::memory_order_relaxed)),
+  };
+  ERL_NIF_TERM stats;
+  enif_make_map_from_arrays(env, keys, values, 2, &stats);
+  return stats;
+}
+
+static ERL_NIF_TERM parse_uri_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  ErlNifBinary binary;
+  if (argc != 1 || !enif_inspect_binary(env, argv[0], &binary))
+    return enif_make_badarg(env);
+  ScopedArena scoped_arena;
+  StringPiece input(reinterpret_cast<const char*>(binary.data), binary.size);
+  ERL_NIF_TERM uri = MakeAtom(ATOM_invalid_uri);
+  if (HasSipUriScheme(input))
+    uri = MakeUri(env, input);
+  if (enif_is_atom(env, uri))
+    return enif_make_tuple2(env, MakeAtom(ATOM_error), uri);
+  return enif_make_tuple2(env, MakeAtom(ATOM_ok), uri);
+}
+
+// Parses the URI binary given to uri_equal/2 or uri_hash/1, in place.
+bool GetSipUri(ErlNifEnv* env, ERL_NIF_TERM term, SipUri* uri) {
+  ErlNifBinary binary;
+  if (!enif_inspect_binary(env, term, &binary))
+    return false;
+  return ParseSipUri(
+      StringPiece(reinterpret_cast<const char*>(binary.data), binary.size),
+      uri);
+}
+
+static ERL_NIF_TERM uri_equal_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  SipUri a, b;
+  if (argc != 2
+      || !GetSipUri(env, argv[0], &a)
+      || !GetSipUri(env, argv[1], &b))
+    return enif_make_badarg(env);
+  return MakeAtom(SipUriEquals(a, b) ? ATOM_true : ATOM_false);
+}
+
+static ERL_NIF_TERM uri_hash_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  SipUri uri;
+  if (argc != 1 || !GetSipUri(env, argv[0], &uri))
+    return enif_make_badarg(env);
+  return enif_make_uint64(env, SipUriHash(uri));
+}
+
+static ERL_NIF_TERM serialize_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  if (argc != 1 || !enif_is_map(env, argv[0]))
+    return enif_make_badarg(env);
+  return Serialize(env, argv[0], SerializeOptions());
+}
+
+static ERL_NIF_TERM serialize_with_options_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  SerializeOptions options;
+  if (argc != 2
+      || !enif_is_map(env, argv[0])
+      || !GetSerializeOptions(env, argv[1], &options))
+    return enif_make_badarg(env);
+  return Serialize(env, argv[0], options);
+}
+
+static ERL_NIF_TERM edit_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  ErlNifBinary bin;
+  if (argc != 2 || !enif_inspect_binary(env, argv[0], &bin))
+    return enif_make_badarg(env);
+  return ScheduleBySize(env, bin.size, "edit", edit_wrapper, argc, argv,
+      [&] { return Edit(env, argv[0], argv[1]); });
+}
+
+static ERL_NIF_TERM new_framer_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  size_t max_message_size = 65535;
+  if (argc != 1 || !GetFramerOptions(env, argv[0], &max_message_size))
+    return enif_make_badarg(env);
+  return NewFramer(env, max_message_size);
+}
+
+static ERL_NIF_TERM frame_wrapper(ErlNifEnv* env, int argc,
+    const ERL_NIF_TERM argv[]) {
+  Framer* framer;
+  if (argc != 2
+      || !GetFramer(env, argv[0], &framer)
+      || !enif_is_binary(env, argv[1]))
+    return enif_make_badarg(env);
+  return FrameChunk(env, framer, argv[1]);
+}
+
+int on_load(ErlNifEnv* env, void** priv_data, ERL_NIF_TERM load_info) {
+  return LoadPrivData(env, priv_data, ERL_NIF_RT_CREATE);
+}
+
+int on_upgrade(ErlNifEnv* env, void** priv_data, void** old_priv_data,
+    ERL_NIF_TERM load_info) {
+  return LoadPrivData(env, priv_data,
+      static_cast<ErlNifResourceFlags>(ERL_NIF_RT_CREATE
+                                       | ERL_NIF_RT_TAKEOVER));
+}
+
+void on_unload(ErlNifEnv* env, void* priv_data) {
+  // The old library may share |g_priv| with the new one after an upgrade.
+  if (g_priv == priv_data)
+    g_priv = nullptr;
+  enif_free(priv_data);
 }
 
 static ErlNifFunc nif_funcs[] = {
   {"parse", 1, parse_wrapper},
+  {"parse", 2, parse_with_options_wrapper},
+  {"parse_many", 1, parse_many_wrapper},
+  {"parse_lazy", 1, parse_lazy_wrapper},
+  {"start_line", 1, start_line_wrapper},
+  {"get_header", 2, get_header_wrapper},
+  {"raw_header", 2, raw_header_wrapper},
+  {"header_names", 1, header_names_wrapper},
+  {"new_framer", 1, new_framer_wrapper},
+  {"frame", 2, frame_wrapper},
+  {"stats", 0, stats_wrapper},
+  {"parse_uri", 1, parse_uri_wrapper},
+  {"uri_equal", 2, uri_equal_wrapper},
+  {"uri_hash", 1, uri_hash_wrapper},
+  {"serialize", 1, serialize_wrapper},
+  {"serialize", 2, serialize_with_options_wrapper},
+  {"edit", 2, edit_wrapper},
 };
 
-ERL_NIF_INIT(Elixir.Sippet.Parser, nif_funcs, on_load, NULL, NULL, NULL)
+ERL_NIF_INIT(Elixir.Sippet.Parser, nif_funcs, on_load, NULL, on_upgrade,
+    on_unload)
 
 }  // extern "C"
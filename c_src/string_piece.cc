@@ -172,6 +172,24 @@ size_type StringPiece::find_first_not_of(char c, size_type pos) const {
   return npos;
 }
 
+size_type StringPiece::find_first_of(const CharClass& chars,
+                                     size_type pos) const {
+  for (size_type i = pos; i < length_; ++i) {
+    if (chars.Contains(ptr_[i]))
+      return i;
+  }
+  return npos;
+}
+
+size_type StringPiece::find_first_not_of(const CharClass& chars,
+                                         size_type pos) const {
+  for (size_type i = pos; i < length_; ++i) {
+    if (!chars.Contains(ptr_[i]))
+      return i;
+  }
+  return npos;
+}
+
 size_type StringPiece::find_last_of(const StringPiece& s, size_type pos) const {
   if (length_ == 0 || s.length_ == 0)
     return npos;
@@ -38,6 +38,8 @@
 
 #include <string>
 
+#include "char_class.h"
+
 class StringPiece {
  public:
   // standard STL container boilerplate
@@ -74,6 +76,8 @@ class StringPiece {
     // that may point to the end() of a string.
     ptr_ = length_ > 0 ? &*begin : nullptr;
   }
+  StringPiece(const_iterator begin, const_iterator end)
+    : ptr_(begin), length_(static_cast<size_t>(end - begin)) { }
 
   // data() may return a pointer to a buffer with embedded NULs, and the
   // returned buffer may or may not be null terminated.  Therefore it is
@@ -167,6 +171,11 @@ class StringPiece {
   }
   size_type find_first_not_of(const StringPiece& s, size_type pos = 0) const;
   size_type find_first_not_of(char c, size_type pos = 0) const;
+  // Same as above, with a set of characters built at compile time, which
+  // spares building a lookup table on each call.
+  size_type find_first_of(const CharClass& chars, size_type pos = 0) const;
+  size_type find_first_not_of(const CharClass& chars,
+                              size_type pos = 0) const;
   size_type find_last_of(const StringPiece& s, size_type pos = npos) const;
   size_type find_last_of(char c, size_type pos = npos) const {
     return rfind(c, pos);
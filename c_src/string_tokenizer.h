@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <string>
 
+#include "arena.h"
 #include "string_piece.h"
 
 // StringTokenizerT is a simple string tokenizer class.  It works like an
@@ -251,6 +252,7 @@ typedef StringTokenizerT<std::string, std::string::const_iterator>
     StringTokenizer;
 typedef StringTokenizerT<std::wstring, std::wstring::const_iterator>
     WStringTokenizer;
-typedef StringTokenizerT<std::string, const char*> CStringTokenizer;
+// Used by the parser, which keeps the delimiters in the thread arena.
+typedef StringTokenizerT<ArenaString, const char*> CStringTokenizer;
 
 #endif  // STRING_TOKENIZER_H_
@@ -4,8 +4,8 @@
 
 #include "tokenizer.h"
 
-Tokenizer::Tokenizer(std::string::const_iterator string_begin,
-                     std::string::const_iterator string_end)
+Tokenizer::Tokenizer(StringPiece::const_iterator string_begin,
+                     StringPiece::const_iterator string_end)
   : current_(string_begin), end_(string_end) {
 }
 
@@ -5,33 +5,32 @@
 #ifndef TOKENIZER_H_
 #define TOKENIZER_H_
 
-#include <string>
-
+#include "char_class.h"
 #include "string_piece.h"
 
 class Tokenizer {
 public:
-  Tokenizer(std::string::const_iterator string_begin,
-            std::string::const_iterator string_end);
+  Tokenizer(StringPiece::const_iterator string_begin,
+            StringPiece::const_iterator string_end);
   ~Tokenizer();
 
-  std::string::const_iterator Skip(const StringPiece& chars) {
+  StringPiece::const_iterator Skip(const CharClass& chars) {
     for (; current_ != end_; ++current_) {
-      if (chars.find(*current_) == std::string::npos)
+      if (!chars.Contains(*current_))
         break;
     }
     return current_;
   }
 
-  std::string::const_iterator SkipNotIn(const StringPiece& chars) {
+  StringPiece::const_iterator SkipNotIn(const CharClass& chars) {
     for (; current_ != end_; ++current_) {
-      if (chars.find(*current_) != std::string::npos)
+      if (chars.Contains(*current_))
         break;
     }
     return current_;
   }
 
-  std::string::const_iterator SkipTo(char c) {
+  StringPiece::const_iterator SkipTo(char c) {
     for (; current_ != end_; ++current_) {
       if (c == *current_)
         break;
@@ -39,13 +38,13 @@ public:
     return current_;
   }
 
-  std::string::const_iterator Skip() {
+  StringPiece::const_iterator Skip() {
     if (current_ != end_)
       ++current_;
     return current_;
   }
 
-  std::string::const_iterator Skip(int n) {
+  StringPiece::const_iterator Skip(int n) {
     for (; current_ != end_ && n > 0; --n)
       ++current_;
     return current_;
@@ -55,19 +54,19 @@ public:
     return current_ == end_;
   }
 
-  std::string::const_iterator current() const { return current_; }
-  void set_current(std::string::const_iterator current) {
+  StringPiece::const_iterator current() const { return current_; }
+  void set_current(StringPiece::const_iterator current) {
     current_ = current;
   }
 
-  std::string::const_iterator end() const { return end_; }
-  void set_end(std::string::const_iterator end) {
+  StringPiece::const_iterator end() const { return end_; }
+  void set_end(StringPiece::const_iterator end) {
     end_ = end;
   }
 
 private:
-  std::string::const_iterator current_;
-  std::string::const_iterator end_;
+  StringPiece::const_iterator current_;
+  StringPiece::const_iterator end_;
 };
 
 #endif // TOKENIZER_H_
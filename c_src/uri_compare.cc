@@ -0,0 +1,279 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "uri_compare.h"
+
+#include "ip_address.h"
+#include "utils.h"
+
+namespace {
+
+// A name=value pair of the parameters or headers of a URI. The value is
+// empty for parameters without one.
+struct UriPair {
+  StringPiece name;
+  StringPiece value;
+};
+
+// Iterates over the pairs of the parameters or headers of a URI, skipping
+// empty ones, in place.
+class UriPairsIterator {
+ public:
+  UriPairsIterator(StringPiece pairs, char delimiter)
+    : rest_(pairs), delimiter_(delimiter) {
+  }
+
+  bool GetNext(UriPair* pair) {
+    while (!rest_.empty()) {
+      size_t end = rest_.find(delimiter_);
+      StringPiece token = rest_.substr(0, end);
+      rest_ = end == StringPiece::npos ? StringPiece() : rest_.substr(end + 1);
+      if (token.empty())
+        continue;
+      size_t equals = token.find('=');
+      pair->name = token.substr(0, equals);
+      pair->value = equals == StringPiece::npos ? StringPiece()
+                                                : token.substr(equals + 1);
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  StringPiece rest_;
+  char delimiter_;
+};
+
+// The parameters that cannot be ignored when only one of the URIs has them.
+struct SpecialParameter {
+  const char* name;
+  bool ignore_case;
+};
+
+const SpecialParameter kSpecialParameters[] = {
+  {"user", true},
+  {"ttl", false},
+  {"method", false},
+  {"maddr", true},
+  {"transport", true},
+};
+
+bool IsVisualSeparator(char c) {
+  return c == '-' || c == '.' || c == '(' || c == ')';
+}
+
+// Compares two components, decoding their escapes. Visual separators are
+// skipped in telephone numbers.
+bool ComponentsEqual(StringPiece a, StringPiece b, bool ignore_case,
+    bool telephone_number = false) {
+  UriComponentReader reader_a(a), reader_b(b);
+  char c_a, c_b;
+  while (true) {
+    bool has_a, has_b;
+    do {
+      has_a = reader_a.Next(&c_a);
+    } while (has_a && telephone_number && IsVisualSeparator(c_a));
+    do {
+      has_b = reader_b.Next(&c_b);
+    } while (has_b && telephone_number && IsVisualSeparator(c_b));
+    if (!has_a || !has_b)
+      return has_a == has_b;
+    if (ignore_case) {
+      c_a = ToLowerASCII(c_a);
+      c_b = ToLowerASCII(c_b);
+    }
+    if (c_a != c_b)
+      return false;
+  }
+}
+
+// Finds the last pair named |name|, regardless of case, as the maps built by
+// the parser keep the last value of repeated names.
+bool FindPair(StringPiece pairs, char delimiter, StringPiece name,
+    UriPair* result) {
+  UriPairsIterator it(pairs, delimiter);
+  UriPair pair;
+  bool found = false;
+  while (it.GetNext(&pair)) {
+    if (ComponentsEqual(pair.name, name, true)) {
+      *result = pair;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Whether |pair| is not overridden by a later pair of the same name.
+bool IsLastPair(StringPiece pairs, char delimiter, const UriPair& pair) {
+  UriPair last;
+  FindPair(pairs, delimiter, pair.name, &last);
+  return last.name.data() == pair.name.data();
+}
+
+const SpecialParameter* FindSpecialParameter(StringPiece name) {
+  for (const auto& special : kSpecialParameters) {
+    if (ComponentsEqual(name, special.name, true))
+      return &special;
+  }
+  return nullptr;
+}
+
+// Whether the pairs of |a| are all in |b|, with equal values.
+bool PairsIncluded(StringPiece a, StringPiece b, char delimiter,
+    bool ignore_case) {
+  UriPairsIterator it(a, delimiter);
+  UriPair pair, other;
+  while (it.GetNext(&pair)) {
+    if (!IsLastPair(a, delimiter, pair))
+      continue;
+    if (!FindPair(b, delimiter, pair.name, &other)
+        || !ComponentsEqual(pair.value, other.value, ignore_case))
+      return false;
+  }
+  return true;
+}
+
+bool SipParametersEqual(StringPiece a, StringPiece b) {
+  for (const auto& special : kSpecialParameters) {
+    UriPair pair_a, pair_b;
+    bool in_a = FindPair(a, ';', special.name, &pair_a);
+    bool in_b = FindPair(b, ';', special.name, &pair_b);
+    if (in_a != in_b)
+      return false;
+  }
+  UriPairsIterator it(a, ';');
+  UriPair pair, other;
+  while (it.GetNext(&pair)) {
+    if (!IsLastPair(a, ';', pair) || !FindPair(b, ';', pair.name, &other))
+      continue;
+    const SpecialParameter* special = FindSpecialParameter(pair.name);
+    if (!ComponentsEqual(pair.value, other.value,
+                         special != nullptr && special->ignore_case))
+      return false;
+  }
+  return true;
+}
+
+bool HostsEqual(StringPiece a, StringPiece b) {
+  uint16_t groups_a[8], groups_b[8];
+  if (ParseIPv6Address(a, groups_a) && ParseIPv6Address(b, groups_b)) {
+    for (int i = 0; i < 8; ++i) {
+      if (groups_a[i] != groups_b[i])
+        return false;
+    }
+    return true;
+  }
+  return ComponentsEqual(a, b, true);
+}
+
+// The 64-bit FNV-1a hash of the decoded octets fed to it.
+class Hasher {
+ public:
+  Hasher() : hash_(14695981039346656037ULL) {}
+
+  void Add(char c) {
+    hash_ = (hash_ ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+  }
+
+  void AddUint64(uint64_t value) {
+    for (int i = 0; i < 8; ++i, value >>= 8)
+      Add(static_cast<char>(value & 0xff));
+  }
+
+  // Adds a component, followed by a separator.
+  void AddComponent(StringPiece s, bool ignore_case,
+      bool telephone_number = false) {
+    UriComponentReader reader(s);
+    char c;
+    while (reader.Next(&c)) {
+      if (telephone_number && IsVisualSeparator(c))
+        continue;
+      Add(ignore_case ? ToLowerASCII(c) : c);
+    }
+    Add('\0');
+  }
+
+  uint64_t hash() const { return hash_; }
+
+ private:
+  uint64_t hash_;
+};
+
+// Adds the pairs of |pairs| regardless of their order, by summing their
+// hashes.
+void AddPairs(Hasher* hasher, StringPiece pairs, char delimiter,
+    bool ignore_case) {
+  uint64_t sum = 0;
+  UriPairsIterator it(pairs, delimiter);
+  UriPair pair;
+  while (it.GetNext(&pair)) {
+    if (!IsLastPair(pairs, delimiter, pair))
+      continue;
+    Hasher pair_hasher;
+    pair_hasher.AddComponent(pair.name, true);
+    pair_hasher.AddComponent(pair.value, ignore_case);
+    sum += pair_hasher.hash();
+  }
+  hasher->AddUint64(sum);
+}
+
+}  // namespace
+
+bool SipUriEquals(const SipUri& a, const SipUri& b) {
+  if (!ComponentsEqual(a.scheme, b.scheme, true))
+    return false;
+
+  if (LowerCaseEqualsASCII(a.scheme, "tel")) {
+    // Parameters are compared as sets, regardless of case.
+    return ComponentsEqual(a.user, b.user, true, true)
+        && PairsIncluded(a.parameters, b.parameters, ';', true)
+        && PairsIncluded(b.parameters, a.parameters, ';', true);
+  }
+
+  return a.has_user == b.has_user
+      && ComponentsEqual(a.user, b.user, false)
+      && a.has_password == b.has_password
+      && ComponentsEqual(a.password, b.password, false)
+      && HostsEqual(a.host, b.host)
+      && a.port == b.port
+      && SipParametersEqual(a.parameters, b.parameters)
+      && PairsIncluded(a.headers, b.headers, '&', false)
+      && PairsIncluded(b.headers, a.headers, '&', false);
+}
+
+uint64_t SipUriHash(const SipUri& uri) {
+  Hasher hasher;
+  hasher.AddComponent(uri.scheme, true);
+
+  if (LowerCaseEqualsASCII(uri.scheme, "tel")) {
+    hasher.AddComponent(uri.user, true, true);
+    AddPairs(&hasher, uri.parameters, ';', true);
+    return hasher.hash();
+  }
+
+  hasher.Add(uri.has_user);
+  hasher.AddComponent(uri.user, false);
+  hasher.Add(uri.has_password);
+  hasher.AddComponent(uri.password, false);
+  uint16_t groups[8];
+  if (ParseIPv6Address(uri.host, groups)) {
+    for (int i = 0; i < 8; ++i)
+      hasher.AddUint64(groups[i]);
+  } else {
+    hasher.AddComponent(uri.host, true);
+  }
+  hasher.AddUint64(static_cast<uint64_t>(uri.port));
+
+  // Other parameters may be in only one of two equivalent URIs, so only
+  // these can be hashed.
+  for (const auto& special : kSpecialParameters) {
+    UriPair pair;
+    bool found = FindPair(uri.parameters, ';', special.name, &pair);
+    hasher.Add(found);
+    if (found)
+      hasher.AddComponent(pair.value, special.ignore_case);
+  }
+  AddPairs(&hasher, uri.headers, '&', false);
+  return hasher.hash();
+}
@@ -0,0 +1,27 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef URI_COMPARE_H_
+#define URI_COMPARE_H_
+
+#include <cstdint>
+
+#include "uri_parser.h"
+
+// Whether two URIs parsed by ParseSipUri() are equivalent, following the
+// rules of RFC 3261, section 19.1.4: escapes are decoded, the scheme, host
+// and parameter names are compared regardless of case, the user, ttl,
+// method, maddr and transport parameters must be in both URIs or in
+// neither, other parameters are only compared when in both, and headers
+// must match exactly. TEL URIs are compared as in RFC 3966, section 4,
+// ignoring visual separators in the number.
+//
+// Components are decoded while they are compared, without copies.
+bool SipUriEquals(const SipUri& a, const SipUri& b);
+
+// A 64-bit hash of the canonical form of a URI: equivalent URIs, as defined
+// by SipUriEquals(), have the same hash.
+uint64_t SipUriHash(const SipUri& uri);
+
+#endif // URI_COMPARE_H_
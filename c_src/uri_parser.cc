@@ -0,0 +1,186 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "uri_parser.h"
+
+#include <cstdint>
+
+#include "char_class.h"
+#include "ip_address.h"
+#include "number_parser.h"
+#include "tokenizer.h"
+#include "utils.h"
+
+namespace {
+
+// The character sets of RFC 3261, section 25.1.
+constexpr CharClass kAlphanumChars =
+    CharClass::Range('a', 'z') | CharClass::Range('A', 'Z')
+    | CharClass::Range('0', '9');
+constexpr CharClass kHexChars =
+    CharClass::Range('0', '9') | CharClass::Range('a', 'f')
+    | CharClass::Range('A', 'F');
+constexpr CharClass kUnreservedChars = kAlphanumChars | CharClass("-_.!~*'()");
+
+// user = 1*( unreserved / escaped / user-unreserved )
+constexpr CharClass kUserChars = kUnreservedChars | CharClass("%&=+$,;?/");
+
+// password = *( unreserved / escaped / "&" / "=" / "+" / "$" / "," )
+constexpr CharClass kPasswordChars = kUnreservedChars | CharClass("%&=+$,");
+
+constexpr CharClass kHostnameChars = kAlphanumChars | CharClass("-.");
+constexpr CharClass kDigitChars = CharClass::Range('0', '9');
+
+// uri-parameters = *( ";" pname ["=" pvalue] ), with paramchar in the names
+// and values.
+constexpr CharClass kParameterChars =
+    kUnreservedChars | CharClass("%[]/:&+$;=");
+
+// headers = "?" header *( "&" header ), with hnv-unreserved, unreserved and
+// escaped characters in the names and values.
+constexpr CharClass kHeaderChars = kUnreservedChars | CharClass("%[]/?:+$&=");
+
+// The telephone-subscriber of RFC 3966, both global and local numbers.
+constexpr CharClass kTelephoneChars = kHexChars | CharClass("+*#-.()");
+
+// Whether all the bytes of |input| are in |chars|, and every '%' starts an
+// escaped octet.
+bool IsValidComponent(StringPiece input, const CharClass& chars) {
+  for (size_t i = 0; i < input.size(); ++i) {
+    if (!chars.Contains(input[i]))
+      return false;
+    if (input[i] == '%') {
+      if (input.size() - i < 3
+          || !kHexChars.Contains(input[i + 1])
+          || !kHexChars.Contains(input[i + 2]))
+        return false;
+      i += 2;
+    }
+  }
+  return true;
+}
+
+int HexValue(char c) {
+  if (c <= '9')
+    return c - '0';
+  return (c | 0x20) - 'a' + 10;
+}
+
+// Splits the ";parameters?headers" suffix following the host or number.
+bool ParseParametersAndHeaders(Tokenizer* tok, bool allow_headers,
+    SipUri* uri) {
+  if (!tok->EndOfInput() && *tok->current() == ';') {
+    StringPiece::const_iterator parameters_start = tok->Skip();
+    uri->parameters = StringPiece(parameters_start, tok->SkipTo('?'));
+    if (!IsValidComponent(uri->parameters, kParameterChars))
+      return false;
+  }
+  if (!tok->EndOfInput()) {
+    if (!allow_headers || *tok->current() != '?')
+      return false;
+    StringPiece::const_iterator headers_start = tok->Skip();
+    uri->headers = StringPiece(headers_start, tok->end());
+    if (!IsValidComponent(uri->headers, kHeaderChars))
+      return false;
+  }
+  return true;
+}
+
+bool ParseTelUri(Tokenizer* tok, SipUri* uri) {
+  StringPiece::const_iterator number_start = tok->current();
+  uri->user = StringPiece(number_start, tok->Skip(kTelephoneChars));
+  uri->has_user = true;
+  if (uri->user.empty())
+    return false;
+  return ParseParametersAndHeaders(tok, false, uri);
+}
+
+}  // namespace
+
+bool HasSipUriScheme(StringPiece input) {
+  StringPiece scheme = input.substr(0, input.find(':'));
+  return scheme.size() != input.size()
+      && (LowerCaseEqualsASCII(scheme, "sip")
+          || LowerCaseEqualsASCII(scheme, "sips")
+          || LowerCaseEqualsASCII(scheme, "tel"));
+}
+
+bool ParseSipUri(StringPiece input, SipUri* uri) {
+  if (!HasSipUriScheme(input))
+    return false;
+
+  Tokenizer tok(input.begin(), input.end());
+  uri->scheme = StringPiece(input.begin(), tok.SkipTo(':'));
+  tok.Skip();
+  if (LowerCaseEqualsASCII(uri->scheme, "tel"))
+    return ParseTelUri(&tok, uri);
+
+  // userinfo = ( user / telephone-subscriber ) [ ":" password ] "@"
+  // The user may have ';' and '?', but neither the user nor the rest of the
+  // URI may have an unescaped '@'.
+  Tokenizer at(tok.current(), tok.end());
+  at.SkipTo('@');
+  if (!at.EndOfInput()) {
+    Tokenizer userinfo(tok.current(), at.current());
+    StringPiece::const_iterator user_start = userinfo.current();
+    uri->user = StringPiece(user_start, userinfo.SkipTo(':'));
+    uri->has_user = true;
+    if (uri->user.empty() || !IsValidComponent(uri->user, kUserChars))
+      return false;
+    if (!userinfo.EndOfInput()) {
+      StringPiece::const_iterator password_start = userinfo.Skip();
+      uri->password = StringPiece(password_start, userinfo.end());
+      uri->has_password = true;
+      if (!IsValidComponent(uri->password, kPasswordChars))
+        return false;
+    }
+    tok.set_current(at.Skip());
+  }
+
+  // hostport = host [ ":" port ]
+  if (!tok.EndOfInput() && *tok.current() == '[') {
+    StringPiece::const_iterator host_start = tok.Skip();
+    uri->host = StringPiece(host_start, tok.SkipTo(']'));
+    uint16_t groups[8];
+    if (tok.EndOfInput() || !ParseIPv6Address(uri->host, groups))
+      return false;
+    tok.Skip();
+  } else {
+    StringPiece::const_iterator host_start = tok.current();
+    uri->host = StringPiece(host_start, tok.Skip(kHostnameChars));
+    if (uri->host.empty())
+      return false;
+  }
+  if (!tok.EndOfInput() && *tok.current() == ':') {
+    StringPiece::const_iterator port_start = tok.Skip();
+    StringPiece port(port_start, tok.Skip(kDigitChars));
+    if (!ParseDecimalInt(port, &uri->port) || uri->port > 65535)
+      return false;
+  }
+
+  return ParseParametersAndHeaders(&tok, true, uri);
+}
+
+bool UriComponentReader::Next(char* c) {
+  if (current_ == end_)
+    return false;
+  if (*current_ == '%' && end_ - current_ >= 3) {
+    *c = static_cast<char>(
+        (HexValue(current_[1]) << 4) | HexValue(current_[2]));
+    current_ += 3;
+  } else {
+    *c = *current_++;
+  }
+  return true;
+}
+
+ArenaString UnescapeUri(StringPiece input) {
+  ArenaString result;
+  result.reserve(input.size());
+  UriComponentReader reader(input);
+  char c;
+  while (reader.Next(&c))
+    result.push_back(c);
+  return result;
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2017 The Sippet Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef URI_PARSER_H_
+#define URI_PARSER_H_
+
+#include "arena.h"
+#include "string_piece.h"
+
+// The components of a SIP or SIPS URI (RFC 3261, section 19.1.1), or of a
+// TEL URI (RFC 3966), referring to the parsed input. The user, password,
+// parameters and headers are still escaped, see UnescapeUri().
+struct SipUri {
+  SipUri() : has_user(false), has_password(false), port(-1) {}
+
+  StringPiece scheme;
+
+  // The userinfo, or in TEL URIs, the telephone number.
+  bool has_user;
+  StringPiece user;
+  bool has_password;
+  StringPiece password;
+
+  // Empty in TEL URIs. IPv6 references are returned without brackets.
+  StringPiece host;
+
+  // -1 if the URI has no port.
+  int port;
+
+  // The uri-parameters without the leading ';', and the headers without the
+  // leading '?'.
+  StringPiece parameters;
+  StringPiece headers;
+};
+
+// Whether |input| starts with one of the schemes handled by ParseSipUri(),
+// regardless of case.
+bool HasSipUriScheme(StringPiece input);
+
+// Splits a SIP, SIPS or TEL URI into its components, checking the characters
+// of each one against the grammar, escapes included. Returns false if
+// |input| is not such a URI.
+bool ParseSipUri(StringPiece input, SipUri* uri);
+
+// Reads the octets of a component validated by ParseSipUri() one at a time,
+// decoding its %HH escapes.
+class UriComponentReader {
+ public:
+  explicit UriComponentReader(StringPiece component)
+    : current_(component.data()), end_(component.data() + component.size()) {
+  }
+
+  // Sets |*c| to the next octet, returning false at the end of the input.
+  bool Next(char* c);
+
+ private:
+  const char* current_;
+  const char* end_;
+};
+
+// Decodes the %HH escapes of a component validated by ParseSipUri(). The
+// result is allocated from the thread arena.
+ArenaString UnescapeUri(StringPiece input);
+
+#endif // URI_PARSER_H_
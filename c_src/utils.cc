@@ -13,211 +13,9 @@
 #include <iostream>
 #include <limits>
 
-namespace {
-
-// Utility to convert a character to a digit in a given base
-template<typename CHAR, int BASE, bool BASE_LTE_10> class BaseCharToDigit {
-};
-
-// Faster specialization for bases <= 10
-template<typename CHAR, int BASE> class BaseCharToDigit<CHAR, BASE, true> {
- public:
-  static bool Convert(CHAR c, uint8_t* digit) {
-    if (c >= '0' && c < '0' + BASE) {
-      *digit = static_cast<uint8_t>(c - '0');
-      return true;
-    }
-    return false;
-  }
-};
-
-// Specialization for bases where 10 < base <= 36
-template<typename CHAR, int BASE> class BaseCharToDigit<CHAR, BASE, false> {
- public:
-  static bool Convert(CHAR c, uint8_t* digit) {
-    if (c >= '0' && c <= '9') {
-      *digit = c - '0';
-    } else if (c >= 'a' && c < 'a' + BASE - 10) {
-      *digit = c - 'a' + 10;
-    } else if (c >= 'A' && c < 'A' + BASE - 10) {
-      *digit = c - 'A' + 10;
-    } else {
-      return false;
-    }
-    return true;
-  }
-};
-
-template <int BASE, typename CHAR>
-bool CharToDigit(CHAR c, uint8_t* digit) {
-  return BaseCharToDigit<CHAR, BASE, BASE <= 10>::Convert(c, digit);
-}
-
-// There is an IsUnicodeWhitespace for wchars defined in string_util.h, but it
-// is locale independent, whereas the functions we are replacing were
-// locale-dependent. TBD what is desired, but for the moment let's not
-// introduce a change in behaviour.
-template<typename CHAR> class WhitespaceHelper {
-};
-
-template<> class WhitespaceHelper<char> {
- public:
-  static bool Invoke(char c) {
-    return 0 != isspace(static_cast<unsigned char>(c));
-  }
-};
-
-template<typename CHAR> bool LocalIsWhitespace(CHAR c) {
-  return WhitespaceHelper<CHAR>::Invoke(c);
-}
-
-// IteratorRangeToNumberTraits should provide:
-//  - a typedef for iterator_type, the iterator type used as input.
-//  - a typedef for value_type, the target numeric type.
-//  - static functions min, max (returning the minimum and maximum permitted
-//    values)
-//  - constant kBase, the base in which to interpret the input
-template<typename IteratorRangeToNumberTraits>
-class IteratorRangeToNumber {
- public:
-  typedef IteratorRangeToNumberTraits traits;
-  typedef typename traits::iterator_type const_iterator;
-  typedef typename traits::value_type value_type;
-
-  // Generalized iterator-range-to-number conversion.
-  //
-  static bool Invoke(const_iterator begin,
-                     const_iterator end,
-                     value_type* output) {
-    bool valid = true;
-
-    while (begin != end && LocalIsWhitespace(*begin)) {
-      valid = false;
-      ++begin;
-    }
-
-    if (begin != end && *begin == '-') {
-      if (!std::numeric_limits<value_type>::is_signed) {
-        *output = 0;
-        valid = false;
-      } else if (!Negative::Invoke(begin + 1, end, output)) {
-        valid = false;
-      }
-    } else {
-      if (begin != end && *begin == '+') {
-        ++begin;
-      }
-      if (!Positive::Invoke(begin, end, output)) {
-        valid = false;
-      }
-    }
-
-    return valid;
-  }
-
- private:
-  // Sign provides:
-  //  - a static function, CheckBounds, that determines whether the next digit
-  //    causes an overflow/underflow
-  //  - a static function, Increment, that appends the next digit appropriately
-  //    according to the sign of the number being parsed.
-  template<typename Sign>
-  class Base {
-   public:
-    static bool Invoke(const_iterator begin, const_iterator end,
-                       typename traits::value_type* output) {
-      *output = 0;
-
-      if (begin == end) {
-        return false;
-      }
-
-      // Note: no performance difference was found when using template
-      // specialization to remove this check in bases other than 16
-      if (traits::kBase == 16 && end - begin > 2 && *begin == '0' &&
-          (*(begin + 1) == 'x' || *(begin + 1) == 'X')) {
-        begin += 2;
-      }
-
-      for (const_iterator current = begin; current != end; ++current) {
-        uint8_t new_digit = 0;
-
-        if (!CharToDigit<traits::kBase>(*current, &new_digit)) {
-          return false;
-        }
+#include "number_parser.h"
 
-        if (current != begin) {
-          if (!Sign::CheckBounds(output, new_digit)) {
-            return false;
-          }
-          *output *= traits::kBase;
-        }
-
-        Sign::Increment(new_digit, output);
-      }
-      return true;
-    }
-  };
-
-  class Positive : public Base<Positive> {
-   public:
-    static bool CheckBounds(value_type* output, uint8_t new_digit) {
-      if (*output > static_cast<value_type>(traits::max() / traits::kBase) ||
-          (*output == static_cast<value_type>(traits::max() / traits::kBase) &&
-           new_digit > traits::max() % traits::kBase)) {
-        *output = traits::max();
-        return false;
-      }
-      return true;
-    }
-    static void Increment(uint8_t increment, value_type* output) {
-      *output += increment;
-    }
-  };
-
-  class Negative : public Base<Negative> {
-   public:
-    static bool CheckBounds(value_type* output, uint8_t new_digit) {
-      if (*output < traits::min() / traits::kBase ||
-          (*output == traits::min() / traits::kBase &&
-           new_digit > 0 - traits::min() % traits::kBase)) {
-        *output = traits::min();
-        return false;
-      }
-      return true;
-    }
-    static void Increment(uint8_t increment, value_type* output) {
-      *output -= increment;
-    }
-  };
-};
-
-template<typename ITERATOR, typename VALUE, int BASE>
-class BaseIteratorRangeToNumberTraits {
- public:
-  typedef ITERATOR iterator_type;
-  typedef VALUE value_type;
-  static value_type min() {
-    return std::numeric_limits<value_type>::min();
-  }
-  static value_type max() {
-    return std::numeric_limits<value_type>::max();
-  }
-  static const int kBase = BASE;
-};
-
-template <typename VALUE, int BASE>
-class StringPieceToNumberTraits
-    : public BaseIteratorRangeToNumberTraits<StringPiece::const_iterator,
-                                             VALUE,
-                                             BASE> {
-};
-
-template <typename VALUE>
-bool StringToIntImpl(const StringPiece& input, VALUE* output) {
-  return IteratorRangeToNumber<StringPieceToNumberTraits<VALUE, 10> >::Invoke(
-      input.begin(), input.end(), output);
-}
+namespace {
 
 // See RFC 2616 Sec 2.2 for the definition of |token|.
 template<typename It>
@@ -231,10 +29,10 @@ bool IsTokenImpl(It begin, It end) {
   return true;
 }
 
-bool UnquoteImpl(std::string::const_iterator begin,
-                 std::string::const_iterator end,
+bool UnquoteImpl(StringPiece::const_iterator begin,
+                 StringPiece::const_iterator end,
                  bool strict_quotes,
-                 std::string* out) {
+                 ArenaString* out) {
   // Empty string
   if (begin == end)
     return false;
@@ -259,7 +57,8 @@ bool UnquoteImpl(std::string::const_iterator begin,
 
   // Unescape quoted-pair (defined in RFC 2616 section 2.2)
   bool prev_escape = false;
-  std::string unescaped;
+  ArenaString unescaped;
+  unescaped.reserve(end - begin);
   for (; begin != end; ++begin) {
     char c = *begin;
     if (c == '\\' && !prev_escape) {
@@ -280,26 +79,14 @@ bool UnquoteImpl(std::string::const_iterator begin,
   return true;
 }
 
-bool StrictUnquote(std::string::const_iterator begin,
-                   std::string::const_iterator end,
-                   std::string* out) {
+bool StrictUnquote(StringPiece::const_iterator begin,
+                   StringPiece::const_iterator end,
+                   ArenaString* out) {
   return UnquoteImpl(begin, end, true, out);
 }
 
 }  // namespace
 
-bool IsTokenChar(unsigned char c) {
-  return !(c >= 0x80 || c <= 0x1F || c == 0x7F || c == '(' || c == ')' ||
-           c == '<' || c == '>' || c == '@' || c == ',' || c == ';' ||
-           c == ':' || c == '\\' || c == '"' || c == '/' || c == '[' ||
-           c == ']' || c == '?' || c == '=' || c == '{' || c == '}' ||
-           c == ' ' || c == '\t');
-}
-
-bool IsToken(std::string::const_iterator begin,
-             std::string::const_iterator end) {
-  return IsTokenImpl(begin, end);
-}
 bool IsToken(StringPiece::const_iterator begin,
              StringPiece::const_iterator end) {
   return IsTokenImpl(begin, end);
@@ -311,6 +98,10 @@ char ToLowerASCII(char c) {
   return (c >= 'A' && c <= 'Z') ? (c + ('a' - 'A')) : c;
 }
 
+char ToUpperASCII(char c) {
+  return (c >= 'a' && c <= 'z') ? (c - ('a' - 'A')) : c;
+}
+
 std::string ToLowerASCII(StringPiece str) {
   std::string ret;
   ret.reserve(str.size());
@@ -344,25 +135,8 @@ bool LowerCaseEqualsASCII(StringPiece str, StringPiece lowercase_ascii) {
   return true;
 }
 
-bool StringToInt(const StringPiece& input, int* output) {
-  return StringToIntImpl(input, output);
-}
-
-bool StringToDouble(const StringPiece& input, double* output) {
-  try {
-    *output = stod(input.as_string());
-    return true;
-  } catch (const std::exception& e) {
-    return false;
-  }
-}
-
-bool IsLWS(char c) {
-  return strchr(SIP_LWS, c) != NULL;
-}
-
-void TrimLWS(std::string::const_iterator* begin,
-             std::string::const_iterator* end) {
+void TrimLWS(StringPiece::const_iterator* begin,
+             StringPiece::const_iterator* end) {
   // leading whitespace
   while (*begin < *end && IsLWS((*begin)[0]))
     ++(*begin);
@@ -372,24 +146,18 @@ void TrimLWS(std::string::const_iterator* begin,
     --(*end);
 }
 
-bool IsQuote(char c) {
-  // Single quote mark isn't actually part of quoted-text production,
-  // but apparently some servers rely on this.
-  return c == '"' || c == '\'';
-}
-
-std::string Unquote(std::string::const_iterator begin,
-                    std::string::const_iterator end) {
-  std::string result;
+ArenaString Unquote(StringPiece::const_iterator begin,
+                    StringPiece::const_iterator end) {
+  ArenaString result;
   if (!UnquoteImpl(begin, end, false, &result))
-    return std::string(begin, end);
+    return ArenaString(begin, end);
 
   return result;
 }
 
-bool ParseHostAndPort(std::string::const_iterator host_and_port_begin,
-                      std::string::const_iterator host_and_port_end,
-                      std::string* host,
+bool ParseHostAndPort(StringPiece::const_iterator host_and_port_begin,
+                      StringPiece::const_iterator host_and_port_end,
+                      StringPiece* host,
                       int* port) {
   if (host_and_port_begin >= host_and_port_end)
     return false;
@@ -407,7 +175,7 @@ bool ParseHostAndPort(std::string::const_iterator host_and_port_begin,
   // hex4           =  1*4HEXDIG
   // port           =  1*DIGIT
 
-  std::string::const_iterator host_start = host_and_port_begin, host_end;
+  StringPiece::const_iterator host_start = host_and_port_begin, host_end;
   if (*host_and_port_begin == '[') {
     // parse an IPv6 address
     for (; host_and_port_begin < host_and_port_end; host_and_port_begin++) {
@@ -416,7 +184,8 @@ bool ParseHostAndPort(std::string::const_iterator host_and_port_begin,
     }
     if (host_and_port_begin == host_and_port_end)
       return false;
-    host_end = ++host_and_port_begin;
+    ++host_start;
+    host_end = host_and_port_begin++;
   } else {
     // parse a hostname or IPv4 address
     for (; host_and_port_begin < host_and_port_end; host_and_port_begin++) {
@@ -426,7 +195,7 @@ bool ParseHostAndPort(std::string::const_iterator host_and_port_begin,
     host_end = host_and_port_begin;
   }
 
-  std::string::const_iterator port_start, port_end;
+  StringPiece::const_iterator port_start, port_end;
   if (host_and_port_begin < host_and_port_end
       && *host_and_port_begin == ':') {
     port_start = ++host_and_port_begin;
@@ -445,27 +214,27 @@ bool ParseHostAndPort(std::string::const_iterator host_and_port_begin,
   }
 
   if (port_start < port_end) {
-    if (!StringToInt(StringPiece(port_start, port_end), port))
+    if (!ParseDecimalInt(StringPiece(port_start, port_end), port))
       return false;
   } else {
     *port = -1;
   }
 
-  host->assign(host_start, host_end);
+  *host = StringPiece(host_start, host_end);
   return true;
 }
 
-bool ParseHostAndPort(const std::string& host_and_port,
-                      std::string* host,
+bool ParseHostAndPort(StringPiece host_and_port,
+                      StringPiece* host,
                       int* port) {
-  return ParseHostAndPort(
-      host_and_port.begin(), host_and_port.end(), host, port);
+  return ParseHostAndPort(host_and_port.begin(), host_and_port.end(), host,
+      port);
 }
 
 HeadersIterator::HeadersIterator(
-    std::string::const_iterator headers_begin,
-    std::string::const_iterator headers_end,
-    const std::string& line_delimiter)
+    StringPiece::const_iterator headers_begin,
+    StringPiece::const_iterator headers_end,
+    const char* line_delimiter)
     : lines_(headers_begin, headers_end, line_delimiter) {
 }
 
@@ -477,7 +246,7 @@ bool HeadersIterator::GetNext() {
     name_begin_ = lines_.token_begin();
     values_end_ = lines_.token_end();
 
-    std::string::const_iterator colon(std::find(name_begin_, values_end_, ':'));
+    StringPiece::const_iterator colon(std::find(name_begin_, values_end_, ':'));
     if (colon == values_end_)
       continue;  // skip malformed header
 
@@ -512,10 +281,10 @@ bool HeadersIterator::AdvanceTo(const char* name) {
 }
 
 ValuesIterator::ValuesIterator(
-    std::string::const_iterator values_begin,
-    std::string::const_iterator values_end,
+    StringPiece::const_iterator values_begin,
+    StringPiece::const_iterator values_end,
     char delimiter)
-    : values_(values_begin, values_end, std::string(1, delimiter)) {
+    : values_(values_begin, values_end, ArenaString(1, delimiter)) {
   values_.set_quote_chars("\'\"");
 }
 
@@ -538,8 +307,8 @@ bool ValuesIterator::GetNext() {
 }
 
 GenericParametersIterator::GenericParametersIterator(
-    std::string::const_iterator begin,
-    std::string::const_iterator end)
+    StringPiece::const_iterator begin,
+    StringPiece::const_iterator end)
     : props_(begin, end, ';'),
       valid_(true),
       name_begin_(end),
@@ -560,7 +329,7 @@ bool GenericParametersIterator::GetNext() {
   value_end_ = props_.value_end();
   name_begin_ = name_end_ = value_end_;
 
-  std::string::const_iterator equals =
+  StringPiece::const_iterator equals =
       std::find(value_begin_, value_end_, '=');
   if (equals != value_end_ && equals != value_begin_) {
     name_begin_ = value_begin_;
@@ -593,8 +362,8 @@ bool GenericParametersIterator::GetNext() {
 }
 
 NameValuePairsIterator::NameValuePairsIterator(
-    std::string::const_iterator begin,
-    std::string::const_iterator end,
+    StringPiece::const_iterator begin,
+    StringPiece::const_iterator end,
     char delimiter,
     Values optional_values,
     Quotes strict_quotes)
@@ -612,8 +381,8 @@ NameValuePairsIterator::NameValuePairsIterator(
 }
 
 NameValuePairsIterator::NameValuePairsIterator(
-    std::string::const_iterator begin,
-    std::string::const_iterator end,
+    StringPiece::const_iterator begin,
+    StringPiece::const_iterator end,
     char delimiter)
     : NameValuePairsIterator(begin,
                              end,
@@ -646,7 +415,7 @@ bool NameValuePairsIterator::GetNext() {
   name_begin_ = name_end_ = value_end_;
 
   // Scan for the equals sign.
-  std::string::const_iterator equals = std::find(value_begin_, value_end_, '=');
+  StringPiece::const_iterator equals = std::find(value_begin_, value_end_, '=');
   if (equals == value_begin_)
     return valid_ = false;  // Malformed, no name
   if (equals == value_end_ && !values_optional_)
@@ -654,7 +423,7 @@ bool NameValuePairsIterator::GetNext() {
 
   // If an equals sign was found, verify that it wasn't inside of quote marks.
   if (equals != value_end_) {
-    for (std::string::const_iterator it = value_begin_; it != equals; ++it) {
+    for (StringPiece::const_iterator it = value_begin_; it != equals; ++it) {
       if (IsQuote(*it))
         return valid_ = false;  // Malformed, quote appears before equals sign
     }
@@ -14,6 +14,8 @@
 #include <string>
 #include <cstdint>
 
+#include "arena.h"
+#include "char_class.h"
 #include "string_tokenizer.h"
 
 
@@ -21,6 +23,9 @@
 // so we don't want to use it here.
 char ToLowerASCII(char c);
 
+// ASCII-specific toupper.
+char ToUpperASCII(char c);
+
 // Converts the given string to it's ASCII-lowercase equivalent.
 std::string ToLowerASCII(StringPiece str);
 
@@ -28,48 +33,22 @@ std::string ToLowerASCII(StringPiece str);
 // previously-lower-cased ASCII string (typically a constant).
 bool LowerCaseEqualsASCII(StringPiece str, StringPiece lowercase_ascii);
 
-// Perform a best-effort conversion of the input string to a numeric type,
-// setting |*output| to the result of the conversion.  Returns true for
-// "perfect" conversions; returns false in the following cases:
-//  - Overflow. |*output| will be set to the maximum value supported
-//    by the data type.
-//  - Underflow. |*output| will be set to the minimum value supported
-//    by the data type.
-//  - Trailing characters in the string after parsing the number.  |*output|
-//    will be set to the value of the number that was parsed.
-//  - Leading whitespace in the string before parsing the number. |*output| will
-//    be set to the value of the number that was parsed.
-//  - No characters parseable as a number at the beginning of the string.
-//    |*output| will be set to 0.
-//  - Empty string.  |*output| will be set to 0.
-// WARNING: Will write to |output| even when returning false.
-//          Read the comments above carefully.
-bool StringToInt(const StringPiece& input, int* output);
-
-// For floating-point conversions, only conversions of input strings in decimal
-// form are defined to work.  Behavior with strings representing floating-point
-// numbers in hexadecimal, and strings representing non-finite values (such as
-// NaN and inf) is undefined.  Otherwise, these behave the same as the integral
-// variants.  This expects the input string to NOT be specific to the locale.
-// If your input is locale specific, use ICU to read the number.
-// WARNING: Will write to |output| even when returning false.
-//          Read the comments here and above StringToInt() carefully.
-bool StringToDouble(const StringPiece& input, double* output);
-
 // Return true if the character is SIP "linear white space" (SP | HT).
 // This definition corresponds with the SIP_LWS macro, and does not match
 // newlines.
-bool IsLWS(char c);
+inline bool IsLWS(char c) {
+  return kLWSChars.Contains(c);
+}
 
 // This is a macro to support extending this string literal at compile time.
 // Please excuse me polluting your global namespace!
 #define SIP_LWS " \t"
 
-bool IsTokenChar(unsigned char c);
+inline bool IsTokenChar(unsigned char c) {
+  return kTokenChars.Contains(c);
+}
 
 // Whether the string is a valid |token| as defined in RFC 2616 Sec 2.2.
-bool IsToken(std::string::const_iterator begin,
-             std::string::const_iterator end);
 bool IsToken(StringPiece::const_iterator begin,
              StringPiece::const_iterator end);
 inline bool IsToken(StringPiece str) {
@@ -77,23 +56,28 @@ inline bool IsToken(StringPiece str) {
 }
 
 // Trim SIP_LWS chars from the beginning and end of the string.
-void TrimLWS(std::string::const_iterator* begin,
-             std::string::const_iterator* end);
+void TrimLWS(StringPiece::const_iterator* begin,
+             StringPiece::const_iterator* end);
 
 // Whether the character is the start of a quotation mark.
-bool IsQuote(char c);
+// Single quote mark isn't actually part of quoted-text production,
+// but apparently some servers rely on this.
+inline bool IsQuote(char c) {
+  return kQuoteChars.Contains(c);
+}
 
 // RFC 2616 Sec 2.2:
 // quoted-string = ( <"> *(qdtext | quoted-pair ) <"> )
 // Unquote() strips the surrounding quotemarks off a string, and unescapes
 // any quoted-pair to obtain the value contained by the quoted-string.
 // If the input is not quoted, then it works like the identity function.
-std::string Unquote(std::string::const_iterator begin,
-                    std::string::const_iterator end);
+// The result is allocated from the thread arena.
+ArenaString Unquote(StringPiece::const_iterator begin,
+                    StringPiece::const_iterator end);
 
 // Splits an input of the form <host>[":"<port>] into its consitituent parts.
-// Saves the result into |*host| and |*port|. If the input did not have
-// the optional port, sets |*port| to -1.
+// Saves the result into |*host|, which refers to the input, and |*port|.
+// If the input did not have the optional port, sets |*port| to -1.
 // Returns true if the parsing was successful, false otherwise.
 // The returned host is NOT canonicalized, and may be invalid.
 //
@@ -102,12 +86,12 @@ std::string Unquote(std::string::const_iterator begin,
 //
 // The resultant |*host| in both cases will be "::1" (not bracketed).
 bool ParseHostAndPort(
-    std::string::const_iterator host_and_port_begin,
-    std::string::const_iterator host_and_port_end,
-    std::string* host,
+    StringPiece::const_iterator host_and_port_begin,
+    StringPiece::const_iterator host_and_port_end,
+    StringPiece* host,
     int* port);
-bool ParseHostAndPort(const std::string& host_and_port,
-                      std::string* host,
+bool ParseHostAndPort(StringPiece host_and_port,
+                      StringPiece* host,
                       int* port);
 
 // Used to iterate over the name/value pairs of SIP headers.  To iterate
@@ -116,9 +100,9 @@ bool ParseHostAndPort(const std::string& host_and_port,
 // does not expect any).
 class HeadersIterator {
  public:
-  HeadersIterator(std::string::const_iterator headers_begin,
-                  std::string::const_iterator headers_end,
-                  const std::string& line_delimiter);
+  HeadersIterator(StringPiece::const_iterator headers_begin,
+                  StringPiece::const_iterator headers_end,
+                  const char* line_delimiter);
   ~HeadersIterator();
 
   // Advances the iterator to the next header, if any.  Returns true if there
@@ -138,32 +122,32 @@ class HeadersIterator {
     lines_.Reset();
   }
 
-  std::string::const_iterator name_begin() const {
+  StringPiece::const_iterator name_begin() const {
     return name_begin_;
   }
-  std::string::const_iterator name_end() const {
+  StringPiece::const_iterator name_end() const {
     return name_end_;
   }
-  std::string name() const {
-    return std::string(name_begin_, name_end_);
+  StringPiece name() const {
+    return StringPiece(name_begin_, name_end_);
   }
 
-  std::string::const_iterator values_begin() const {
+  StringPiece::const_iterator values_begin() const {
     return values_begin_;
   }
-  std::string::const_iterator values_end() const {
+  StringPiece::const_iterator values_end() const {
     return values_end_;
   }
-  std::string values() const {
-    return std::string(values_begin_, values_end_);
+  StringPiece values() const {
+    return StringPiece(values_begin_, values_end_);
   }
 
  private:
-  StringTokenizer lines_;
-  std::string::const_iterator name_begin_;
-  std::string::const_iterator name_end_;
-  std::string::const_iterator values_begin_;
-  std::string::const_iterator values_end_;
+  CStringTokenizer lines_;
+  StringPiece::const_iterator name_begin_;
+  StringPiece::const_iterator name_end_;
+  StringPiece::const_iterator values_begin_;
+  StringPiece::const_iterator values_end_;
 };
 
 // Iterates over delimited values in a SIP header.  SIP LWS is
@@ -179,8 +163,8 @@ class HeadersIterator {
 //
 class ValuesIterator {
  public:
-  ValuesIterator(std::string::const_iterator values_begin,
-                 std::string::const_iterator values_end,
+  ValuesIterator(StringPiece::const_iterator values_begin,
+                 StringPiece::const_iterator values_end,
                  char delimiter);
   ValuesIterator(const ValuesIterator& other);
   ~ValuesIterator();
@@ -195,20 +179,20 @@ class ValuesIterator {
   // is a next value.  Use value* methods to access the resultant value.
   bool GetNext();
 
-  std::string::const_iterator value_begin() const {
+  StringPiece::const_iterator value_begin() const {
     return value_begin_;
   }
-  std::string::const_iterator value_end() const {
+  StringPiece::const_iterator value_end() const {
     return value_end_;
   }
-  std::string value() const {
-    return std::string(value_begin_, value_end_);
+  StringPiece value() const {
+    return StringPiece(value_begin_, value_end_);
   }
 
  private:
-  StringTokenizer values_;
-  std::string::const_iterator value_begin_;
-  std::string::const_iterator value_end_;
+  CStringTokenizer values_;
+  StringPiece::const_iterator value_begin_;
+  StringPiece::const_iterator value_end_;
 };
 
 // Iterates over SIP header parameters delimited by ';'.  SIP LWS is
@@ -216,43 +200,44 @@ class ValuesIterator {
 //
 class GenericParametersIterator {
  public:
-  GenericParametersIterator(std::string::const_iterator begin,
-                            std::string::const_iterator end);
+  GenericParametersIterator(StringPiece::const_iterator begin,
+                            StringPiece::const_iterator end);
   ~GenericParametersIterator();
 
   bool GetNext();
 
   bool valid() const { return valid_; }
 
-  std::string::const_iterator name_begin() const { return name_begin_; }
-  std::string::const_iterator name_end() const { return name_end_; }
-  std::string name() const { return std::string(name_begin_, name_end_); }
+  StringPiece::const_iterator name_begin() const { return name_begin_; }
+  StringPiece::const_iterator name_end() const { return name_end_; }
+  StringPiece name() const { return StringPiece(name_begin_, name_end_); }
 
-  std::string::const_iterator value_begin() const {
-    return value_is_quoted_ ? unquoted_value_.begin() : value_begin_;
+  StringPiece::const_iterator value_begin() const {
+    return value_is_quoted_ ? unquoted_value_.data() : value_begin_;
   }
-  std::string::const_iterator value_end() const {
-    return value_is_quoted_ ? unquoted_value_.end() : value_end_;
+  StringPiece::const_iterator value_end() const {
+    return value_is_quoted_ ? unquoted_value_.data() + unquoted_value_.size()
+                            : value_end_;
   }
-  std::string value() const {
-    return value_is_quoted_ ? unquoted_value_ : std::string(value_begin_,
-                                                            value_end_);
+  StringPiece value() const {
+    return StringPiece(value_begin(), value_end());
   }
 
-  std::string raw_value() const { return std::string(value_begin_,
-                                                      value_end_); }
+  StringPiece raw_value() const {
+    return StringPiece(value_begin_, value_end_);
+  }
 
  private:
   ValuesIterator props_;
   bool valid_;
 
-  std::string::const_iterator name_begin_;
-  std::string::const_iterator name_end_;
+  StringPiece::const_iterator name_begin_;
+  StringPiece::const_iterator name_end_;
 
-  std::string::const_iterator value_begin_;
-  std::string::const_iterator value_end_;
+  StringPiece::const_iterator value_begin_;
+  StringPiece::const_iterator value_end_;
 
-  std::string unquoted_value_;
+  ArenaString unquoted_value_;
 
   bool value_is_quoted_;
 };
@@ -278,16 +263,16 @@ class NameValuePairsIterator {
   // mismatched or otherwise invalid quotes is considered a parse error.
   enum class Quotes { STRICT_QUOTES, NOT_STRICT };
 
-  NameValuePairsIterator(std::string::const_iterator begin,
-                         std::string::const_iterator end,
+  NameValuePairsIterator(StringPiece::const_iterator begin,
+                         StringPiece::const_iterator end,
                          char delimiter,
                          Values optional_values,
                          Quotes strict_quotes);
 
   // Treats values as not optional by default (Values::REQUIRED) and
   // treats quotes as not strict.
-  NameValuePairsIterator(std::string::const_iterator begin,
-                         std::string::const_iterator end,
+  NameValuePairsIterator(StringPiece::const_iterator begin,
+                         StringPiece::const_iterator end,
                          char delimiter);
 
   NameValuePairsIterator(const NameValuePairsIterator& other);
@@ -303,27 +288,28 @@ class NameValuePairsIterator {
   bool valid() const { return valid_; }
 
   // The name of the current name-value pair.
-  std::string::const_iterator name_begin() const { return name_begin_; }
-  std::string::const_iterator name_end() const { return name_end_; }
-  std::string name() const { return std::string(name_begin_, name_end_); }
+  StringPiece::const_iterator name_begin() const { return name_begin_; }
+  StringPiece::const_iterator name_end() const { return name_end_; }
+  StringPiece name() const { return StringPiece(name_begin_, name_end_); }
 
   // The value of the current name-value pair.
-  std::string::const_iterator value_begin() const {
-    return value_is_quoted_ ? unquoted_value_.begin() : value_begin_;
+  StringPiece::const_iterator value_begin() const {
+    return value_is_quoted_ ? unquoted_value_.data() : value_begin_;
   }
-  std::string::const_iterator value_end() const {
-    return value_is_quoted_ ? unquoted_value_.end() : value_end_;
+  StringPiece::const_iterator value_end() const {
+    return value_is_quoted_ ? unquoted_value_.data() + unquoted_value_.size()
+                            : value_end_;
   }
-  std::string value() const {
-    return value_is_quoted_ ? unquoted_value_ : std::string(value_begin_,
-                                                            value_end_);
+  StringPiece value() const {
+    return StringPiece(value_begin(), value_end());
   }
 
   bool value_is_quoted() const { return value_is_quoted_; }
 
   // The value before unquoting (if any).
-  std::string raw_value() const { return std::string(value_begin_,
-                                                     value_end_); }
+  StringPiece raw_value() const {
+    return StringPiece(value_begin_, value_end_);
+  }
 
  private:
   bool IsQuote(char c) const;
@@ -331,16 +317,16 @@ class NameValuePairsIterator {
   ValuesIterator props_;
   bool valid_;
 
-  std::string::const_iterator name_begin_;
-  std::string::const_iterator name_end_;
+  StringPiece::const_iterator name_begin_;
+  StringPiece::const_iterator name_end_;
 
-  std::string::const_iterator value_begin_;
-  std::string::const_iterator value_end_;
+  StringPiece::const_iterator value_begin_;
+  StringPiece::const_iterator value_end_;
 
   // Do not store iterators into this string. The NameValuePairsIterator
   // is copyable/assignable, and if copied the copy's iterators would point
   // into the original's unquoted_value_ member.
-  std::string unquoted_value_;
+  ArenaString unquoted_value_;
 
   bool value_is_quoted_;
 
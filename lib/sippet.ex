@@ -67,6 +67,17 @@ defmodule Sippet do
       iex> ~K[z9hG4bK74b21|INVITE|client.biloxi.example.com:5060]
       ~K[z9hG4bK74b21|:invite|client.biloxi.example.com:5060]
 
+  Numeric hosts are read as address tuples, as in the keys of the requests
+  received by the transports:
+
+      iex> ~K[z9hG4bK74b21|INVITE|192.0.2.1:5060]
+      ...> |> Map.get(:sentby)
+      {{192, 0, 2, 1}, 5060}
+
+      iex> ~K(z9hG4bK74b21|INVITE|[2001:db8::1]:5060)
+      ...> |> Map.get(:sentby)
+      {{8193, 3512, 0, 0, 0, 0, 0, 1}, 5060}
+
   """
   def sigil_K(string, _) do
     case String.split(string, "|") do
@@ -74,16 +85,33 @@ defmodule Sippet do
         Transactions.Client.Key.new(branch, sigil_to_method(method))
 
       [branch, method, sentby] ->
-        [host, port] = String.split(sentby, ":")
+        [_, host, port] = Regex.run(~r/^(.*):(\d+)$/, sentby)
 
         Transactions.Server.Key.new(
           branch,
           sigil_to_method(method),
-          {host, String.to_integer(port)}
+          {sigil_to_host(host), String.to_integer(port)}
         )
     end
   end
 
+  # The transports parse requests with `inet_addresses: true`, so numeric
+  # sent-by hosts are address tuples in the keys of received requests. As in
+  # the parser, only bracketed hosts are taken as IPv6 addresses.
+  defp sigil_to_host("[" <> rest = host) do
+    case :inet.parse_ipv6strict_address(rest |> String.trim_trailing("]") |> to_charlist()) do
+      {:ok, ip} -> ip
+      {:error, _} -> host
+    end
+  end
+
+  defp sigil_to_host(host) do
+    case :inet.parse_ipv4strict_address(to_charlist(host)) do
+      {:ok, ip} -> ip
+      {:error, _} -> host
+    end
+  end
+
   defp sigil_to_method(method) do
     case method do
       ":" <> rest -> Message.to_method(rest)
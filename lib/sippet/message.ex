@@ -19,7 +19,8 @@ defmodule Sippet.Message do
   defstruct start_line: nil,
             headers: %{},
             body: nil,
-            target: nil
+            target: nil,
+            raw_headers: nil
 
   @type uri :: URI.t()
 
@@ -49,8 +50,8 @@ defmodule Sippet.Message do
           {scheme :: binary, params}
 
   @type via_value ::
-          {{major :: integer, minor :: integer}, protocol, {host :: binary, port :: integer},
-           params}
+          {{major :: integer, minor :: integer}, protocol,
+           {host :: binary | :inet.ip_address(), port :: integer}, params}
 
   @type headers :: %{
           optional(:accept) => [type_subtype_params, ...],
@@ -140,7 +141,8 @@ defmodule Sippet.Message do
                 protocol :: atom | binary,
                 host :: binary,
                 dport :: integer
-              }
+              },
+          raw_headers: nil | %{header => {value, [binary]}}
         }
 
   @type request :: %__MODULE__{
@@ -1206,19 +1208,27 @@ defmodule Sippet.Message do
   end
 
   @doc """
-  Parses a SIP message header block as received by the transport layer.
+  Parses a SIP message as received by the transport layer.
 
-  In order to correctly set the message body, you have to verify the
-  `:content_length` header; if it exists, it reflects the body size and you
-  have to set it manually on the returned message.
-  """
-  @spec parse(iodata) :: {:ok, t} | {:error, atom}
-  def parse(data) do
-    binary_data = IO.iodata_to_binary(data)
+  The body is everything after the empty line ending the header block, or
+  `nil` if there is no such line. It is not checked against the
+  `:content_length` header, unless the `datagram: true` option is given; see
+  `Sippet.Parser.parse/2` for the accepted options.
+
+  With `inet_addresses: true`, numeric `Via` sent-by hosts are returned as
+  `:inet.ip_address()` tuples, which `to_iodata/1` formats back. The `:uris`
+  option is ignored, as URIs are always returned as `Sippet.URI` structs.
 
-    case Sippet.Parser.parse(IO.iodata_to_binary(binary_data)) do
+  With `raw_headers: true`, the original lines of each header are kept in
+  the `:raw_headers` field, and `to_iodata/1` copies them for the headers
+  left unchanged, which is faster and keeps their values byte-exact when
+  forwarding the message.
+  """
+  @spec parse(iodata, keyword) :: {:ok, t} | {:error, atom}
+  def parse(data, options \\ []) do
+    case Sippet.Parser.parse(data, Keyword.delete(options, :uris)) do
       {:ok, message} ->
-        case do_parse(message, binary_data) do
+        case do_parse(message) do
           {:error, reason} ->
             {:error, reason}
 
@@ -1231,7 +1241,7 @@ defmodule Sippet.Message do
     end
   end
 
-  defp do_parse(message, binary_data) do
+  defp do_parse(message) do
     case do_parse_start_line(message.start_line) do
       {:error, reason} ->
         {:error, reason}
@@ -1245,18 +1255,19 @@ defmodule Sippet.Message do
             %__MODULE__{
               start_line: start_line,
               headers: headers,
-              body: get_body(binary_data)
+              body: message.body,
+              raw_headers: do_parse_raw_headers(message, headers)
             }
         end
     end
   end
 
-  defp get_body(binary_data) do
-    case String.split(binary_data, ~r{\r?\n\r?\n}, parts: 2) do
-      [_, body] -> body
-      [_] -> nil
-    end
-  end
+  # The raw lines are kept along with the converted values, which are the
+  # ones compared when serializing.
+  defp do_parse_raw_headers(%{raw_headers: raw_headers}, headers),
+    do: :maps.map(fn name, {_, lines} -> {Map.fetch!(headers, name), lines} end, raw_headers)
+
+  defp do_parse_raw_headers(_message, _headers), do: nil
 
   defp do_parse_start_line(%{method: _} = start_line) do
     case URI.parse(start_line.request_uri) do
@@ -1330,17 +1341,14 @@ defmodule Sippet.Message do
   end
 
   @doc """
-  Parses a SIP message header block as received by the transport layer.
-
-  Raises if the string is an invalid SIP header.
+  Parses a SIP message as received by the transport layer.
 
-  In order to correctly set the message body, you have to verify the
-  `:content_length` header; if it exists, it reflects the body size and you
-  have to set it manually on the returned message.
+  Raises if the string is an invalid SIP message. See `parse/2` for how the
+  body is set.
   """
-  @spec parse!(String.t() | charlist) :: t | no_return
-  def parse!(data) do
-    case parse(data) do
+  @spec parse!(String.t() | charlist, keyword) :: t | no_return
+  def parse!(data, options \\ []) do
+    case parse(data, options) do
       {:ok, message} ->
         message
 
@@ -1359,284 +1367,79 @@ defmodule Sippet.Message do
 
   @doc """
   Returns the iodata representation of the given `Sippet.Message` struct.
+
+  The message is written by `Sippet.Parser.serialize/1` into a single binary.
+  A `Content-Length` header with the size of the body in bytes is added if
+  missing. For messages parsed with `raw_headers: true`, headers left
+  unchanged are written as they were received.
   """
   @spec to_iodata(t) :: iodata
-  def to_iodata(%Sippet.Message{} = message) do
-    start_line =
-      case message.start_line do
-        %RequestLine{} -> RequestLine.to_iodata(message.start_line)
-        %StatusLine{} -> StatusLine.to_iodata(message.start_line)
-      end
-
-    # includes a Content-Length header case it does not have one
-    message =
-      if message.headers |> Map.has_key?(:content_length) do
-        message
-      else
-        len = if(message.body == nil, do: 0, else: String.length(message.body))
-        %{message | headers: Map.put(message.headers, :content_length, len)}
-      end
+  def to_iodata(%Sippet.Message{} = message),
+    do: message |> do_serializable_message() |> Sippet.Parser.serialize()
 
-    [
-      start_line,
-      "\r\n",
-      do_headers(message.headers),
-      "\r\n",
-      if(message.body == nil, do: "", else: message.body)
-    ]
-  end
-
-  defp do_headers(%{} = headers), do: do_headers(Map.to_list(headers), [])
-  defp do_headers([], result), do: result
-
-  defp do_headers([{name, value} | tail], result),
-    do: do_headers(tail, [do_header(name, value) | result])
-
-  defp do_header(name, value) do
-    {name, multiple} =
-      case name do
-        :accept -> {"Accept", true}
-        :accept_encoding -> {"Accept-Encoding", true}
-        :accept_language -> {"Accept-Language", true}
-        :alert_info -> {"Alert-Info", true}
-        :allow -> {"Allow", true}
-        :authentication_info -> {"Authentication-Info", false}
-        :authorization -> {"Authorization", false}
-        :call_id -> {"Call-ID", true}
-        :call_info -> {"Call-Info", true}
-        :contact -> {"Contact", true}
-        :content_disposition -> {"Content-Disposition", true}
-        :content_encoding -> {"Content-Encoding", true}
-        :content_language -> {"Content-Language", true}
-        :content_length -> {"Content-Length", true}
-        :content_type -> {"Content-Type", true}
-        :cseq -> {"CSeq", true}
-        :date -> {"Date", true}
-        :error_info -> {"Error-Info", true}
-        :expires -> {"Expires", true}
-        :from -> {"From", true}
-        :in_reply_to -> {"In-Reply-To", true}
-        :max_forwards -> {"Max-Forwards", true}
-        :mime_version -> {"MIME-Version", true}
-        :min_expires -> {"Min-Expires", true}
-        :organization -> {"Organization", true}
-        :priority -> {"Priority", true}
-        :p_asserted_identity -> {"P-Asserted-Identity", true}
-        :proxy_authenticate -> {"Proxy-Authenticate", false}
-        :proxy_authorization -> {"Proxy-Authorization", false}
-        :proxy_require -> {"Proxy-Require", true}
-        :reason -> {"Reason", true}
-        :record_route -> {"Record-Route", true}
-        :reply_to -> {"Reply-To", true}
-        :require -> {"Require", true}
-        :retry_after -> {"Retry-After", true}
-        :route -> {"Route", true}
-        :server -> {"Server", true}
-        :subject -> {"Subject", true}
-        :supported -> {"Supported", true}
-        :timestamp -> {"Timestamp", true}
-        :to -> {"To", true}
-        :unsupported -> {"Unsupported", true}
-        :user_agent -> {"User-Agent", true}
-        :via -> {"Via", true}
-        :warning -> {"Warning", true}
-        :www_authenticate -> {"WWW-Authenticate", false}
-        other -> {other, true}
-      end
-
-    if multiple do
-      [name, ": ", do_header_values(value, []), "\r\n"]
-    else
-      do_one_per_line(name, value)
-    end
-  end
-
-  defp do_header_values([], values), do: values |> Enum.reverse()
-
-  defp do_header_values([head | tail], values),
-    do: do_header_values(tail, do_join(do_header_value(head), values, ", "))
-
-  defp do_header_values(value, _), do: do_header_value(value)
-
-  defp do_header_value(value) when is_binary(value), do: value
-
-  defp do_header_value(value) when is_integer(value), do: Integer.to_string(value)
-
-  defp do_header_value({sequence, method}) when is_integer(sequence),
-    do: [Integer.to_string(sequence), " ", upcase_atom_or_string(method)]
-
-  defp do_header_value({major, minor})
-       when is_integer(major) and is_integer(minor),
-       do: [Integer.to_string(major), ".", Integer.to_string(minor)]
-
-  defp do_header_value({token, %{} = parameters}) when is_binary(token),
-    do: [token, do_parameters(parameters)]
-
-  defp do_header_value({{type, subtype}, %{} = parameters})
-       when is_binary(type) and is_binary(subtype),
-       do: [type, "/", subtype, do_parameters(parameters)]
-
-  defp do_header_value({display_name, %URI{} = uri, %{} = parameters})
-       when is_binary(display_name) do
-    [
-      if(display_name == "", do: "", else: ["\"", display_name, "\" "]),
-      "<",
-      URI.to_string(uri),
-      ">",
-      do_parameters(parameters)
-    ]
-  end
-
-  defp do_header_value({delta_seconds, comment, %{} = parameters})
-       when is_integer(delta_seconds) and is_binary(comment) do
-    [
-      Integer.to_string(delta_seconds),
-      if(comment != "", do: [" (", comment, ") "], else: ""),
-      do_parameters(parameters)
-    ]
-  end
-
-  defp do_header_value({timestamp, delay})
-       when is_float(timestamp) and is_float(delay) do
-    [Float.to_string(timestamp), if(delay > 0, do: [" ", Float.to_string(delay)], else: "")]
-  end
-
-  defp do_header_value({{major, minor}, protocol, {host, port}, %{} = parameters})
-       when is_integer(major) and is_integer(minor) and
-              is_binary(host) and is_integer(port) do
-    [
-      "SIP/",
-      Integer.to_string(major),
-      ".",
-      Integer.to_string(minor),
-      "/",
-      upcase_atom_or_string(protocol),
-      " ",
-      host,
-      if(port > 0, do: [":", Integer.to_string(port)], else: ""),
-      do_parameters(parameters)
-    ]
-  end
-
-  defp do_header_value({code, agent, text})
-       when is_integer(code) and is_binary(agent) and is_binary(text) do
-    [Integer.to_string(code), " ", agent, " \"", text, "\""]
-  end
+  @doc """
+  Returns the binary representation of a message to be sent over a datagram
+  transport whose path MTU is `mtu` bytes.
+
+  Compact header forms are used if the message would otherwise be within 200
+  bytes of the MTU. Returns `{:needs_stream_transport, binary}` if it is still
+  that large, in which case RFC 3261, section 18.1.1, requires requests to be
+  sent over a congestion controlled transport. See
+  `Sippet.Parser.serialize/2`.
+  """
+  @spec to_datagram(t, pos_integer) :: {:ok | :needs_stream_transport, binary}
+  def to_datagram(%Sippet.Message{} = message, mtu) when is_integer(mtu) and mtu > 0,
+    do: message |> do_serializable_message() |> Sippet.Parser.serialize(mtu: mtu)
 
-  defp do_header_value(%NaiveDateTime{} = value) do
-    day_of_week =
-      case Date.day_of_week(NaiveDateTime.to_date(value)) do
-        1 -> "Mon"
-        2 -> "Tue"
-        3 -> "Wed"
-        4 -> "Thu"
-        5 -> "Fri"
-        6 -> "Sat"
-        7 -> "Sun"
-      end
+  defp do_serializable_message(message) do
+    start_line =
+      case message.start_line do
+        %RequestLine{request_uri: %URI{} = uri} = start_line ->
+          %{start_line | request_uri: URI.to_string(uri)}
 
-    month =
-      case value.month do
-        1 -> "Jan"
-        2 -> "Feb"
-        3 -> "Mar"
-        4 -> "Apr"
-        5 -> "May"
-        6 -> "Jun"
-        7 -> "Jul"
-        8 -> "Aug"
-        9 -> "Sep"
-        10 -> "Oct"
-        11 -> "Nov"
-        12 -> "Dec"
+        start_line ->
+          start_line
       end
 
-    # Microsecond is explicitly removed here, as the RFC 3261 does not define
-    # it. Therefore, while it is accepted, it won't be forwarded.
-    [
-      day_of_week,
-      ", ",
-      String.pad_leading(Integer.to_string(value.day), 2, "0"),
-      " ",
-      month,
-      " ",
-      Integer.to_string(value.year),
-      " ",
-      String.pad_leading(Integer.to_string(value.hour), 2, "0"),
-      ":",
-      String.pad_leading(Integer.to_string(value.minute), 2, "0"),
-      ":",
-      String.pad_leading(Integer.to_string(value.second), 2, "0"),
-      " GMT"
-    ]
-  end
-
-  defp do_one_per_line(name, %{} = value),
-    do: [name, ": ", do_one_per_line_value(value), "\r\n"]
-
-  defp do_one_per_line(name, values) when is_list(values),
-    do: do_one_per_line(name, values |> Enum.reverse(), [])
-
-  defp do_one_per_line(_, [], result), do: result
+    raw_headers = message.raw_headers || %{}
 
-  defp do_one_per_line(name, [head | tail], result),
-    do: do_one_per_line(name, tail, [name, ": ", do_one_per_line_value(head), "\r\n" | result])
-
-  defp do_one_per_line_value(%{} = parameters),
-    do: do_one_per_line_value(Map.to_list(parameters), [])
-
-  defp do_one_per_line_value({scheme, %{} = parameters}),
-    do: [scheme, " ", do_auth_parameters(parameters)]
-
-  defp do_one_per_line_value([], result), do: result
+    # Unchanged headers are copied from their raw lines, so they are left as
+    # they are.
+    headers =
+      :maps.map(
+        fn name, value ->
+          case raw_headers do
+            %{^name => {^value, _}} -> value
+            _ -> do_serializable(value)
+          end
+        end,
+        message.headers
+      )
 
-  defp do_one_per_line_value([{name, value} | tail], result) do
-    do_one_per_line_value(tail, do_join([name, "=", value], result, ", "))
+    %{message | start_line: start_line, headers: headers}
   end
 
-  defp do_parameters(%{} = parameters),
-    do: do_parameters(Map.to_list(parameters), [])
-
-  defp do_parameters([], result), do: result
+  # The parser writes everything but URIs, timestamps and inet addresses,
+  # which are formatted by the modules owning their formats.
+  defp do_serializable(values) when is_list(values),
+    do: Enum.map(values, &do_serializable/1)
 
-  defp do_parameters([{name, ""} | tail], result),
-    do: do_parameters(tail, [";", name | result])
+  defp do_serializable({display_name, %URI{} = uri, %{} = parameters}),
+    do: {display_name, URI.to_string(uri), parameters}
 
-  defp do_parameters([{name, value} | tail], result),
-    do: do_parameters(tail, [";", name, "=", do_maybe_double_quote(value) | result])
-
-  defp do_maybe_double_quote(value) do
-    if String.contains?(value, [" ", "\t", "\""]) do
-      "\"" <> String.replace(value, "\"", "\\\"") <> "\""
+  defp do_serializable({timestamp, delay}) when is_float(timestamp) and is_float(delay) do
+    if delay > 0 do
+      Float.to_string(timestamp) <> " " <> Float.to_string(delay)
     else
-      value
+      Float.to_string(timestamp)
     end
   end
 
-  defp do_join(head, [], _joiner), do: [head]
-  defp do_join(head, tail, joiner), do: [head, joiner | tail]
-
-  defp upcase_atom_or_string(s),
-    do: if(is_atom(s), do: String.upcase(Atom.to_string(s)), else: s)
-
-  defp do_auth_parameters(%{} = parameters),
-    do: do_auth_parameters(Map.to_list(parameters), [])
-
-  defp do_auth_parameters([], result), do: result |> Enum.reverse()
+  defp do_serializable({version, protocol, {host, port}, %{} = parameters})
+       when is_tuple(host),
+       do: {version, protocol, {sent_by_host(host), port}, parameters}
 
-  defp do_auth_parameters([{name, value} | tail], [])
-       when name in ["username", "realm", "nonce", "uri", "response", "cnonce", "opaque"],
-    do: do_auth_parameters(tail, [[name, "=\"", value, "\""]])
-
-  defp do_auth_parameters([{name, value} | tail], []),
-    do: do_auth_parameters(tail, [[name, "=", value]])
-
-  defp do_auth_parameters([{name, value} | tail], result)
-       when name in ["username", "realm", "nonce", "uri", "response", "cnonce", "opaque"],
-    do: do_auth_parameters(tail, [[",", name, "=\"", value, "\""] | result])
-
-  defp do_auth_parameters([{name, value} | tail], result),
-    do: do_auth_parameters(tail, [[",", name, "=", value] | result])
+  defp do_serializable(value), do: value
 
   @doc """
   Checks whether a message is valid.
@@ -1830,13 +1633,32 @@ defmodule Sippet.Message do
     end
   end
 
+  @doc """
+  Returns the textual form of a `Via` sent-by host, which is either a binary
+  or, for messages parsed with `inet_addresses: true`, an IP address tuple.
+  IPv6 addresses are bracketed, as in the header.
+  """
+  @spec sent_by_host(binary | :inet.ip_address()) :: binary
+  def sent_by_host(host) when is_binary(host), do: host
+
+  def sent_by_host({_, _, _, _} = ip), do: ip |> :inet.ntoa() |> to_string()
+
+  def sent_by_host({_, _, _, _, _, _, _, _} = ip),
+    do: "[" <> (ip |> :inet.ntoa() |> to_string()) <> "]"
+
   @doc """
   Extracts the remote address and port from an incoming request inspecting the
   `Via` header. If `;rport` is present, use it instead of the topmost `Via`
   port, if `;received` is present, use it instead of the topmost `Via` host.
+
+  The host is an address tuple if the request was parsed with
+  `inet_addresses: true`, as the requests received by the transports are,
+  and the topmost `Via` has a numeric host and no `;received`.
   """
   @spec get_remote(request) ::
-          {:ok, {protocol :: atom | binary, host :: binary, port :: integer}}
+          {:ok,
+           {protocol :: atom | binary, host :: binary | :inet.ip_address(),
+            port :: integer}}
           | {:error, reason :: term}
   def get_remote(%__MODULE__{start_line: %RequestLine{}, headers: %{via: [topmost_via | _]}}) do
     {_version, protocol, {host, port}, params} = topmost_via
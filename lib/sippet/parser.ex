@@ -21,7 +21,313 @@ defmodule Sippet.Parser do
   Parses the SIP message into an Erlang-like map.
 
   The `Sippet.Message` module translates the result into an Elixir-like struct.
+
+  The message may be given as iodata, such as the list of chunks read from a
+  socket; it is joined with a single copy. Binaries are parsed in place.
+
+  Only the header section, up to the first empty line, is parsed. The rest
+  of the message is returned as `:body`, a sub-binary of `message`, or `nil`
+  when there is no empty line.
+
+  Messages larger than 16 KB are parsed on a dirty CPU scheduler, so that
+  large or crafted messages cannot hold a normal scheduler for long.
+  """
+  def parse(message) when is_binary(message) or is_list(message),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Parses the SIP message into an Erlang-like map, accepting options.
+
+  Available options:
+
+    * `:sub_binaries` - when `true`, string values that are verbatim slices
+      of `message` are returned as sub-binaries referencing it, instead of
+      fresh copies. Values that are lowercased, unquoted or unfolded are still
+      copied. Defaults to `false`.
+    * `:min_sub_binary_size` - values shorter than this are always copied,
+      as a small copy is cheaper than a sub-binary. Defaults to `64`.
+    * `:max_pinned_size` - messages larger than this are never sliced.
+      Defaults to `65535`.
+    * `:only` - a list of header atoms, such as `[:via, :cseq, :call_id]`.
+      When given, all other headers, including the ones not supported by
+      the parser, are skipped without being decoded and are absent from the
+      result. Raises `ArgumentError` for atoms that are not supported
+      headers.
+    * `:datagram` - when `true`, the message is taken as a whole UDP
+      datagram (RFC 3261, section 18.3): the body is truncated to the
+      `Content-Length` header, and `{:error, :truncated_body}` is returned
+      when it is shorter. Defaults to `false`.
+    * `:inet_addresses` - when `true`, numeric `Via` sent-by hosts, such as
+      `192.0.2.1` or `[2001:db8::1]`, are returned as `:inet.ip_address()`
+      tuples, as `:inet.parse_address/1` would, so they can be compared with
+      socket addresses directly. Hostnames are still returned as binaries.
+      Defaults to `false`.
+    * `:uris` - when `true`, the SIP, SIPS and TEL URIs of the request line
+      and of the address headers are returned decomposed, as `parse_uri/1`
+      does, and a malformed one fails the whole message with
+      `:invalid_uri`. URIs of other schemes, such as the `http` URIs of
+      `Call-Info`, are still returned as binaries. Defaults to `false`.
+    * `:raw_headers` - when `true`, the result also has a `:raw_headers` map
+      with a `{value, lines}` tuple per header: its parsed value and the
+      lines it was parsed from, including continuation lines. `serialize/1`
+      copies those lines as they are for the headers whose value is
+      unchanged, instead of formatting it again. The lines take about as
+      much memory again as the header section; they are copies, unless
+      `:sub_binaries` allows referencing `message`. Defaults to `false`.
+
+  Note that a single sub-binary keeps the whole `message` alive, so keeping
+  parsed values for long (for instance, in a transaction or registrar state)
+  pins the original datagram in memory. Use `:binary.copy/1` on values that
+  outlive the message.
+  """
+  def parse(message, options)
+      when (is_binary(message) or is_list(message)) and is_list(options),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Parses a list of SIP messages, such as the datagrams read from a socket
+  in one go, returning a list with one result per message, in order.
+
+  Each result is either `{:ok, message}` or `{:error, reason}`. The batch
+  shares the NIF call and its scratch buffers, and yields back to the
+  scheduler whenever its timeslice is over.
+  """
+  def parse_many(messages) when is_list(messages),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Parses the SIP message lazily, returning an opaque reference to it.
+
+  Only the start line is decoded; the header lines are just indexed. Each
+  header is decoded the first time it is requested through `get_header/2`,
+  and the result is cached for later calls. This suits processes that only
+  inspect a few headers of each message, such as stateless proxies.
+
+  As in `parse/1`, messages larger than 16 KB are indexed on a dirty CPU
+  scheduler, and so are headers of that size when decoded.
+  """
+  def parse_lazy(message) when is_binary(message),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Returns the start line of a message parsed by `parse_lazy/1`, as it would
+  be returned by `parse/1`.
+  """
+  def start_line(message),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Decodes a header of a message parsed by `parse_lazy/1`.
+
+  The header `name` is given as in the headers map returned by `parse/1`:
+  an atom for the supported headers (e.g. `:via`), the name as it appears in
+  the message for the others. Returns `{:ok, values}`, `:error` if the
+  header is not present, or `{:error, reason}` if it could not be parsed.
+  """
+  def get_header(message, name),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Returns the undecoded values of a header of a message parsed by
+  `parse_lazy/1`, one binary per header line, or an empty list.
+  """
+  def raw_header(message, name),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Returns the names of the headers present in a message parsed by
+  `parse_lazy/1`, in order of first appearance.
+  """
+  def header_names(message),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Creates a framer, which splits the byte stream of a TCP or TLS connection
+  into SIP messages, as described in RFC 3261, section 18.3.
+
+  Available options:
+
+    * `:max_message_size` - the largest message accepted, including its
+      body. Defaults to `65535`.
+  """
+  def new_framer(options) when is_list(options),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Feeds a chunk read from the connection to a framer created by
+  `new_framer/1`.
+
+  Returns `{:ok, messages, keepalives}`, where `messages` are the complete
+  messages found so far, in order, ready for `parse/1`. Messages lying
+  entirely within `chunk` are sub-binaries of it; the bytes of an incomplete
+  message are kept by the framer until the following chunks complete it.
+
+  Line breaks between messages are skipped. `keepalives` is the number of
+  RFC 5626 keepalive pings (a double CRLF) received, each of which should be
+  answered with a single CRLF.
+
+  Returns `{:error, reason}` when a message lacks a valid `Content-Length`
+  header or exceeds the `:max_message_size`. The stream cannot be resumed
+  after that, and the connection should be closed.
+  """
+  def frame(framer, chunk) when is_binary(chunk),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Parses a SIP or SIPS URI (RFC 3261, section 19.1.1) or a TEL URI
+  (RFC 3966) into a map with the following keys:
+
+    * `:scheme` - the lowercase scheme, `"sip"`, `"sips"` or `"tel"`.
+    * `:user` and `:password` - the userinfo parts, or `nil`. The user of a
+      TEL URI is its telephone number.
+    * `:host` - the host, or `nil` in TEL URIs. IPv6 references are returned
+      without brackets.
+    * `:port` - the port, or `nil` if the URI has none.
+    * `:parameters` - a map of the URI parameters, with lowercase names.
+      Parameters without a value map to `""`.
+    * `:headers` - a map of the URI headers.
+
+  Escaped characters are decoded in all of them. Returns
+  `{:error, :invalid_uri}` if `uri` is not such a URI.
+
+      iex> Sippet.Parser.parse_uri("sip:alice@atlanta.com;transport=tcp")
+      {:ok,
+       %{headers: %{}, host: "atlanta.com", parameters: %{"transport" => "tcp"},
+         password: nil, port: nil, scheme: "sip", user: "alice"}}
+
+  """
+  def parse_uri(uri) when is_binary(uri),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Returns whether two SIP, SIPS or TEL URIs are equivalent, according to
+  RFC 3261, section 19.1.4 (or RFC 3966, section 4, for TEL URIs).
+
+  Escapes are decoded, and the scheme, host and parameter names are compared
+  regardless of case. The `user`, `ttl`, `method`, `maddr` and `transport`
+  parameters must be in both URIs or in neither, while other parameters are
+  only compared when present in both. URI headers must all match.
+
+      iex> Sippet.Parser.uri_equal("sip:%61lice@atlanta.com;transport=TCP",
+      ...>   "sip:alice@AtLanTa.CoM;Transport=tcp")
+      true
+      iex> Sippet.Parser.uri_equal("sip:bob@biloxi.com",
+      ...>   "sip:bob@biloxi.com:5060")
+      false
+
+  Raises `ArgumentError` if either is not such a URI.
+  """
+  def uri_equal(uri1, uri2) when is_binary(uri1) and is_binary(uri2),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Returns a 64-bit hash of the canonical form of a SIP, SIPS or TEL URI.
+  Equivalent URIs, as defined by `uri_equal/2`, have the same hash, so it can
+  key tables of URIs such as registrar bindings; URIs with the same hash must
+  still be compared with `uri_equal/2`, as parameters that only one of them
+  has are left out of the hash.
+
+  Raises `ArgumentError` if `uri` is not such a URI.
+  """
+  def uri_hash(uri) when is_binary(uri),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Serializes a message into a single binary, the inverse of `parse/1`.
+
+  The message is either a map returned by `parse/1` or a `Sippet.Message`
+  struct. URIs and the sent-by hosts of `Via` headers must be binaries. Header
+  names are written in their canonical form, and the values of authentication
+  headers one per line. A `Content-Length` header with the size of the body in
+  bytes is added if missing. If the message has a `:raw_headers` map, as
+  returned by `parse/2`, headers whose value is still equal to the parsed one
+  are written as their original lines.
+
+  Raises `ArgumentError` if the message has values it cannot write.
+  """
+  def serialize(message) when is_map(message),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Serializes a message as `serialize/1`, for a datagram transport.
+
+  Options:
+
+    * `:mtu` - the path MTU of the transport, in bytes. RFC 3261, section
+      18.1.1, requires requests within 200 bytes of it to be sent over a
+      congestion controlled transport, such as TCP. If the message is larger
+      than that, it is written with the compact forms of its headers, such as
+      `v` for `Via` and `f` for `From`.
+
+  Returns `{:ok, binary}` if the message fits, or
+  `{:needs_stream_transport, binary}`, with the full header forms, if it does
+  not fit even with compact forms. The final size is `byte_size(binary)`.
+  """
+  def serialize(message, options) when is_map(message) and is_list(options),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Edits a message as a proxy forwarding it would, without parsing it into
+  terms. Header lines are only located, and the result is an iolist of
+  sub-binaries of `binary` and the inserted bytes, which can be given to the
+  transport as is.
+
+  Operations:
+
+    * `{:add_via, value}` - adds a `Via` line above the top one.
+    * `{:received, address, port}` - stamps the top `Via` with the source of
+      the request, as `received` if its sent-by host is not `address`, and
+      as `rport` if its sent-by port is not `port`. `address` is a numeric
+      IP address binary, such as `"192.0.2.1"` or `"2001:db8::1"`, without
+      brackets.
+    * `:pop_route` - removes the top `Route` value, if any. Repeated, it
+      removes the values following the ones already removed.
+    * `:decrement_max_forwards` - decrements `Max-Forwards`, or adds it with
+      70 if missing.
+    * `{:add_record_route, value}` - adds a `Record-Route` line above the top
+      one.
+
+  Operations refer to the message as given, so `{:received, address, port}`
+  stamps the received `Via` even if a new one is added. Returns
+  `{:error, :too_many_hops}` if `Max-Forwards` is already 0,
+  `{:error, :overlapping_edits}` if two operations edit the same part of the
+  message, such as `:decrement_max_forwards` given twice, and
+  `{:error, reason}` if a header to edit is invalid.
+
+      iex> {:ok, iodata} =
+      ...>   Sippet.Parser.edit(
+      ...>     "OPTIONS sip:bob@biloxi.com SIP/2.0\\r\\n" <>
+      ...>       "Via: SIP/2.0/UDP 192.0.2.1;branch=z9hG4bK74bf9\\r\\n" <>
+      ...>       "Max-Forwards: 70\\r\\n\\r\\n",
+      ...>     [{:add_via, "SIP/2.0/UDP proxy.biloxi.com;branch=z9hG4bK2d4"},
+      ...>      {:received, "198.51.100.7", 5060},
+      ...>      :decrement_max_forwards]
+      ...>   )
+      iex> IO.iodata_to_binary(iodata)
+      "OPTIONS sip:bob@biloxi.com SIP/2.0\\r\\n" <>
+        "Via: SIP/2.0/UDP proxy.biloxi.com;branch=z9hG4bK2d4\\r\\n" <>
+        "Via: SIP/2.0/UDP 192.0.2.1;branch=z9hG4bK74bf9;received=198.51.100.7\\r\\n" <>
+        "Max-Forwards: 69\\r\\n\\r\\n"
+
+  Messages larger than 16 KB are edited on a dirty CPU scheduler, as in
+  `parse/1`.
+
+  Raises `ArgumentError` if an operation is invalid or inserts line breaks.
+  """
+  def edit(binary, operations) when is_binary(binary) and is_list(operations),
+    do: :erlang.nif_error(:not_loaded)
+
+  @doc """
+  Returns the parser counters since the NIF module was loaded. Only the slow
+  paths are counted, so that counting costs nothing to the common case.
+
+    * `:folded` - how many messages had headers spanning multiple lines;
+      those are copied in order to be unfolded, while the others are parsed
+      in place.
+    * `:date_fallbacks` - how many `Date` headers were not in the RFC 1123
+      format required by RFC 3261, such as `Sun, 06 Nov 1994 08:49:37 GMT`,
+      and had to go through the slower, general date parser.
   """
-  def parse(message) when is_binary(message),
+  def stats(),
     do: :erlang.nif_error(:not_loaded)
 end
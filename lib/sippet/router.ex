@@ -26,7 +26,7 @@ defmodule Sippet.Router do
     do: handle_transport_message(sippet, rest, from)
 
   def handle_transport_message(sippet, raw, from) do
-    with {:ok, message} <- parse_message(raw),
+    with {:ok, message} <- parse_message(raw, from),
          prepared_message <- update_via(message, from),
          :ok <- Message.validate(prepared_message, from) do
       receive_transport_message(sippet, prepared_message)
@@ -44,19 +44,14 @@ defmodule Sippet.Router do
     end
   end
 
-  defp parse_message(packet) do
-    case String.split(packet, ~r{\r?\n\r?\n}, parts: 2) do
-      [header, body] ->
-        parse_message(header, body)
+  # Numeric Via sent-by hosts are parsed as address tuples, so the cores and
+  # the server transaction keys of received requests see them as tuples too.
+  # `Sippet.sigil_K/2` reads numeric hosts the same way.
+  defp parse_message(packet, {protocol, _host, _port}) do
+    options = [datagram: protocol == :udp, inet_addresses: true, raw_headers: true]
 
-      [header] ->
-        parse_message(header, "")
-    end
-  end
-
-  defp parse_message(header, body) do
-    case Message.parse(header) do
-      {:ok, message} -> {:ok, %{message | body: body}}
+    case Message.parse(packet, options) do
+      {:ok, %{body: nil} = message} -> {:ok, %{message | body: ""}}
       other -> other
     end
   end
@@ -72,11 +67,11 @@ defmodule Sippet.Router do
     request
     |> Message.update_header_back(:via, fn
       {version, protocol, {via_host, via_port}, params} ->
-        host = ip |> ip_to_string()
-
+        # Numeric sent-by hosts are parsed as address tuples, so they can be
+        # compared with the source address without formatting it.
         params =
-          if host != via_host do
-            params |> Map.put("received", host)
+          if ip != via_host do
+            params |> Map.put("received", ip_to_string(ip))
           else
             params
           end
@@ -11,7 +11,7 @@ defmodule Sippet.Transactions.Server.Key do
   @type branch :: binary
 
   @typedoc "The topmost Via header sent-by parameter"
-  @type sentby :: {shost :: binary, sport :: integer}
+  @type sentby :: {shost :: binary | :inet.ip_address(), sport :: integer}
 
   @type t :: %__MODULE__{
     branch: binary,
@@ -66,11 +66,11 @@ defmodule Sippet.Transactions.Server.Key do
 
   defimpl String.Chars do
     def to_string(%{branch: branch, method: method, sentby: {host, port}}),
-      do: "#{branch}:#{method}:#{host}:#{port}"
+      do: "#{branch}:#{method}:#{Message.sent_by_host(host)}:#{port}"
   end
 
   defimpl Inspect do
     def inspect(%{branch: branch, method: method, sentby: {host, port}}, _),
-      do: "~K[#{branch}|#{inspect method}|#{host}:#{port}]"
+      do: "~K[#{branch}|#{inspect method}|#{Message.sent_by_host(host)}:#{port}]"
   end
 end
@@ -18,10 +18,20 @@ defmodule Sippet.Transports.UDP do
 
   defstruct socket: nil,
             family: :inet,
+            mtu: 1500,
             sippet: nil
 
   @doc """
   Starts the UDP transport.
+
+  Options:
+
+    * `:name` - the name of the `Sippet` stack (required).
+    * `:port` - the port to listen on, defaults to 5060.
+    * `:address` - the address to listen on, or an `{address, family}` tuple,
+      defaults to `"0.0.0.0"`.
+    * `:mtu` - the path MTU, defaults to 1500. Messages that would be within
+      200 bytes of it are sent with compact header forms.
   """
   def start_link(options) when is_list(options) do
     name =
@@ -66,6 +76,18 @@ defmodule Sippet.Transports.UDP do
           {"0.0.0.0", :inet}
       end
 
+    mtu =
+      case Keyword.fetch(options, :mtu) do
+        {:ok, mtu} when is_integer(mtu) and mtu > 0 ->
+          mtu
+
+        {:ok, other} ->
+          raise ArgumentError, "expected :mtu to be a positive integer, got: #{inspect(other)}"
+
+        :error ->
+          1500
+      end
+
     ip =
       case resolve_name(address, family) do
         {:ok, ip} ->
@@ -76,18 +98,18 @@ defmodule Sippet.Transports.UDP do
                 ":address contains an invalid IP or DNS name, got: #{inspect(reason)}"
       end
 
-    GenServer.start_link(__MODULE__, {name, ip, port, family})
+    GenServer.start_link(__MODULE__, {name, ip, port, family, mtu})
   end
 
   @impl true
-  def init({name, ip, port, family}) do
+  def init({name, ip, port, family, mtu}) do
     Sippet.register_transport(name, :udp, false)
 
-    {:ok, nil, {:continue, {name, ip, port, family}}}
+    {:ok, nil, {:continue, {name, ip, port, family, mtu}}}
   end
 
   @impl true
-  def handle_continue({name, ip, port, family}, nil) do
+  def handle_continue({name, ip, port, family, mtu}, nil) do
     case :gen_udp.open(port, [:binary, {:active, true}, {:ip, ip}, family]) do
       {:ok, socket} ->
         Logger.debug(
@@ -98,6 +120,7 @@ defmodule Sippet.Transports.UDP do
         state = %__MODULE__{
           socket: socket,
           family: family,
+          mtu: mtu,
           sippet: name
         }
 
@@ -111,7 +134,7 @@ defmodule Sippet.Transports.UDP do
 
         Process.sleep(10_000)
 
-        {:noreply, nil, {:continue, {name, ip, port, family}}}
+        {:noreply, nil, {:continue, {name, ip, port, family, mtu}}}
     end
   end
 
@@ -126,7 +149,7 @@ defmodule Sippet.Transports.UDP do
   def handle_call(
         {:send_message, message, to_host, to_port, key},
         _from,
-        %{socket: socket, family: family, sippet: sippet} = state
+        %{socket: socket, family: family, mtu: mtu, sippet: sippet} = state
       ) do
     Logger.debug([
       "sending message to #{stringify_hostport(to_host, to_port)}/udp",
@@ -134,12 +157,25 @@ defmodule Sippet.Transports.UDP do
     ])
 
     with {:ok, to_ip} <- resolve_name(to_host, family),
-         iodata <- Message.to_iodata(message),
-         :ok <- :gen_udp.send(socket, {to_ip, to_port}, iodata) do
+         {status, packet} <- Message.to_datagram(message, mtu),
+         :ok <- :gen_udp.send(socket, {to_ip, to_port}, packet) do
+      # There is no stream transport to fall back to, so the message is sent
+      # anyway, and may be fragmented.
+      if status == :needs_stream_transport do
+        Logger.warning(
+          "message of #{byte_size(packet)} bytes to " <>
+            "#{stringify_hostport(to_host, to_port)}/udp is within 200 bytes " <>
+            "of the path MTU (#{mtu})"
+        )
+      end
+
       :ok
     else
       {:error, reason} ->
-        Logger.warning("udp transport error for #{to_host}:#{to_port}: #{inspect(reason)}")
+        Logger.warning(
+          "udp transport error for #{stringify_hostport(to_host, to_port)}: " <>
+            "#{inspect(reason)}"
+        )
 
         if key != nil do
           Sippet.Router.receive_transport_error(sippet, key, reason)
@@ -158,6 +194,8 @@ defmodule Sippet.Transports.UDP do
     :gen_udp.close(socket)
   end
 
+  defp resolve_name(host, _family) when is_tuple(host), do: {:ok, host}
+
   defp resolve_name(host, family) do
     host
     |> String.to_charlist()
@@ -176,6 +214,6 @@ defmodule Sippet.Transports.UDP do
   end
 
   defp stringify_hostport(host, port) do
-    "#{host}:#{port}"
+    "#{Message.sent_by_host(host)}:#{port}"
   end
 end
@@ -0,0 +1,568 @@
+defmodule Sippet.Parser.Test do
+  use ExUnit.Case, async: true
+
+  alias Sippet.Parser, as: Parser
+
+  @message """
+           INVITE sip:bob@biloxi.example.com;transport=tcp SIP/2.0
+           Via: SIP/2.0/TCP client.atlanta.example.com:5060;branch=z9hG4bK74bf9
+           Max-Forwards: 70
+           From: Alice <sip:alice@atlanta.example.com>;tag=9fxced76sl
+           To: Bob <sip:bob@biloxi.example.com>
+           Call-ID: 3848276298220188511@atlanta.example.com
+           CSeq: 1 INVITE
+           Contact: <sip:alice@client.atlanta.example.com;transport=tcp>
+           X-Custom-Header: a value long enough to be returned as a sub-binary
+           Content-Length: 0
+
+           """
+           |> String.replace("\n", "\r\n")
+
+  test "sub-binary mode returns the same values as the default mode" do
+    expected = Parser.parse(@message)
+
+    assert Parser.parse(@message, []) == expected
+    assert Parser.parse(@message, sub_binaries: true) == expected
+    assert Parser.parse(@message,
+        sub_binaries: true, min_sub_binary_size: 0) == expected
+    assert Parser.parse(@message,
+        sub_binaries: true, max_pinned_size: 0) == expected
+  end
+
+  test "sub-binary mode references the input only when allowed" do
+    custom_header = fn options ->
+      {:ok, %{headers: %{"X-Custom-Header" => [value]}}} =
+        Parser.parse(@message, options)
+      value
+    end
+
+    value = custom_header.(sub_binaries: true, min_sub_binary_size: 0)
+    assert :binary.referenced_byte_size(value) == byte_size(@message)
+
+    for options <- [[],
+                    [sub_binaries: true],
+                    [sub_binaries: true, min_sub_binary_size: 0,
+                     max_pinned_size: 0]] do
+      value = custom_header.(options)
+      assert :binary.referenced_byte_size(value) == byte_size(value)
+    end
+  end
+
+  test "sub-binary mode rejects invalid options" do
+    assert_raise ArgumentError, fn ->
+      Parser.parse(@message, sub_binaries: :yes)
+    end
+
+    assert_raise ArgumentError, fn ->
+      Parser.parse(@message, min_sub_binary_size: -1)
+    end
+
+    assert_raise ArgumentError, fn ->
+      Parser.parse(@message, unknown: true)
+    end
+  end
+
+  test "counts messages with folded headers" do
+    folded = String.replace(@message, "Max-Forwards: 70",
+        "Max-Forwards:\r\n 70")
+
+    %{folded: count} = Parser.stats()
+    assert Parser.parse(folded) == Parser.parse(@message)
+
+    stats = Parser.stats()
+    assert stats.folded >= count + 1
+  end
+
+  test "parses large messages" do
+    vias =
+      for i <- 1..1000 do
+        "Via: SIP/2.0/UDP host#{i}.example.com;branch=z9hG4bK#{i}\r\n"
+      end
+
+    [start_line, rest] = String.split(@message, "\r\n", parts: 2)
+    message = IO.iodata_to_binary([start_line, "\r\n", vias, rest])
+    assert byte_size(message) > 16 * 1024
+
+    {:ok, %{headers: headers}} = Parser.parse(message)
+    assert length(headers.via) == 1001
+
+    {:ok, lazy} = Parser.parse_lazy(message)
+    assert Parser.get_header(lazy, :via) == {:ok, headers.via}
+  end
+
+  test "parses start lines without a line break" do
+    assert {:ok, %{start_line: %{status_code: 200, reason_phrase: ""}}} =
+             Parser.parse("SIP/2.0 200")
+    assert Parser.parse("SIP/2.0 ") == :empty_status_code
+    assert Parser.parse("INVITE ") == :missing_uri
+    assert Parser.parse("INVITE sip:bob@biloxi.com ") == :missing_version_spec
+
+    # The bytes following a sub-binary are not part of the message.
+    assert {:ok, %{start_line: %{status_code: 200}}} =
+             Parser.parse(binary_part("SIP/2.0 200999", 0, 11))
+  end
+
+  test "parses a batch of messages" do
+    invalid = "INVITE\r\n"
+    assert Parser.parse(invalid) == :missing_method
+
+    results = Parser.parse_many([@message, invalid, @message])
+    assert results == [Parser.parse(@message), {:error, :missing_method},
+                       Parser.parse(@message)]
+
+    assert Parser.parse_many([]) == []
+
+    assert_raise ArgumentError, fn ->
+      Parser.parse_many([@message, :not_a_binary])
+    end
+  end
+
+  test "decodes headers lazily" do
+    {:ok, %{start_line: start_line, headers: headers}} = Parser.parse(@message)
+    {:ok, message} = Parser.parse_lazy(@message)
+
+    assert Parser.start_line(message) == start_line
+    assert Enum.sort(Parser.header_names(message)) ==
+           Enum.sort(Map.keys(headers))
+
+    for {name, values} <- headers do
+      assert Parser.get_header(message, name) == {:ok, values}
+      assert Parser.get_header(message, name) == {:ok, values}
+    end
+
+    assert Parser.get_header(message, :route) == :error
+    assert Parser.raw_header(message, :max_forwards) == ["70"]
+    assert Parser.raw_header(message, "X-Custom-Header") ==
+           ["a value long enough to be returned as a sub-binary"]
+    assert Parser.raw_header(message, :route) == []
+  end
+
+  test "reports errors of lazily decoded headers" do
+    invalid = String.replace(@message, "CSeq: 1 INVITE", "CSeq: x INVITE")
+    {:ok, message} = Parser.parse_lazy(invalid)
+
+    assert Parser.get_header(message, :cseq) == {:error, :invalid_sequence}
+    assert {:ok, _} = Parser.get_header(message, :via)
+
+    assert Parser.parse_lazy("INVITE\r\n") == {:error, :missing_method}
+  end
+
+  test "parses only the selected headers" do
+    {:ok, %{start_line: start_line, headers: headers}} = Parser.parse(@message)
+    only = [:via, :cseq, :call_id]
+
+    assert Parser.parse(@message, only: only) ==
+           {:ok, %{start_line: start_line, headers: Map.take(headers, only),
+                   body: ""}}
+
+    assert {:ok, %{headers: %{}}} = Parser.parse(@message, only: [])
+
+    assert_raise ArgumentError, fn ->
+      Parser.parse(@message, only: [:callid])
+    end
+  end
+
+  test "splits the body from the header section" do
+    message = String.replace(@message, "Content-Length: 0", "Content-Length: 3")
+
+    assert {:ok, %{body: "abc", headers: %{content_length: 3}}} =
+             Parser.parse(message <> "abc")
+    assert {:ok, %{body: "abcdef"}} = Parser.parse(message <> "abcdef")
+    assert {:ok, %{body: "ab"}} = Parser.parse(message <> "ab")
+
+    # Header-like lines in the body are not taken as headers.
+    {:ok, %{headers: headers, body: body}} =
+      Parser.parse(message <> "c: d\r\n")
+    refute Map.has_key?(headers, :content_type)
+    assert body == "c: d\r\n"
+
+    [header_section, _] = String.split(@message, "\r\n\r\n")
+    assert {:ok, %{body: nil}} = Parser.parse(header_section)
+  end
+
+  test "applies the Content-Length to datagrams" do
+    message = String.replace(@message, "Content-Length: 0", "Content-Length: 3")
+
+    assert {:ok, %{body: "abc"}} =
+             Parser.parse(message <> "abcdef", datagram: true)
+    assert Parser.parse(message <> "ab", datagram: true) ==
+           {:error, :truncated_body}
+    assert {:ok, %{body: ""}} = Parser.parse(@message, datagram: true)
+
+    assert_raise ArgumentError, fn ->
+      Parser.parse(@message, datagram: :yes)
+    end
+  end
+
+  test "frames messages from a stream" do
+    body_message =
+      String.replace(@message, "Content-Length: 0", "Content-Length: 3") <>
+        "abc"
+    stream = "\r\n\r\n" <> @message <> "\r\n" <> body_message <> @message
+
+    for size <- [1, 7, 100, byte_size(stream)] do
+      framer = Parser.new_framer([])
+
+      {messages, keepalives} =
+        stream
+        |> chunks(size)
+        |> Enum.reduce({[], 0}, fn chunk, {messages, keepalives} ->
+          {:ok, framed, count} = Parser.frame(framer, chunk)
+          {messages ++ framed, keepalives + count}
+        end)
+
+      assert messages == [@message, body_message, @message]
+      assert keepalives == 1
+    end
+  end
+
+  test "rejects streams that cannot be framed" do
+    missing = String.replace(@message, "Content-Length: 0\r\n", "")
+    framer = Parser.new_framer([])
+    assert Parser.frame(framer, missing) == {:error, :missing_content_length}
+    assert Parser.frame(framer, @message) == {:error, :missing_content_length}
+
+    framer = Parser.new_framer(max_message_size: 100)
+    assert Parser.frame(framer, @message) == {:error, :message_too_large}
+
+    assert_raise ArgumentError, fn ->
+      Parser.new_framer(max_message_size: -1)
+    end
+  end
+
+  test "keeps the last value of repeated parameters" do
+    params = Enum.map_join(1..20, fn i -> ";p#{i}=#{i}" end)
+    message =
+      String.replace(@message, "branch=z9hG4bK74bf9",
+          "branch=z9hG4bK74bf9#{params};P1=last")
+
+    {:ok, %{headers: %{via: [{_, _, _, via_params}]}}} = Parser.parse(message)
+    assert map_size(via_params) == 21
+    assert via_params["p1"] == "last"
+    assert via_params["p20"] == "20"
+  end
+
+  test "joins the lines of repeated headers in order" do
+    message =
+      String.replace(@message, "Max-Forwards: 70\r\n",
+          "X-Custom-Header: first\r\nVia: SIP/2.0/UDP a.example.com\r\n" <>
+            "Max-Forwards: 70\r\nVia: SIP/2.0/UDP b.example.com, " <>
+            "SIP/2.0/UDP c.example.com\r\n")
+
+    {:ok, %{headers: headers}} = Parser.parse(message)
+    assert for({_, _, {host, _}, _} <- headers.via, do: host) ==
+           ["client.atlanta.example.com", "a.example.com", "b.example.com",
+            "c.example.com"]
+    assert headers["X-Custom-Header"] ==
+           ["first", "a value long enough to be returned as a sub-binary"]
+
+    duplicated = String.replace(@message, "Max-Forwards: 70",
+        "Max-Forwards: 70\r\nMax-Forwards: 69")
+    assert Parser.parse(duplicated) == {:error, :multiple_definition}
+  end
+
+  test "parses messages given as iodata" do
+    expected = Parser.parse(@message)
+    [first, second, third] = chunks(@message, 200)
+
+    assert Parser.parse([first, second, third]) == expected
+    assert Parser.parse([first, [second | third]], []) == expected
+    assert Parser.parse(String.to_charlist(@message)) == expected
+
+    assert_raise ArgumentError, fn ->
+      Parser.parse([@message, :not_iodata])
+    end
+  end
+
+  test "parses numeric header values" do
+    message =
+      String.replace(@message, "Max-Forwards: 70",
+          "Max-Forwards: 0070\r\nTimestamp: 54.21 1.5\r\nExpires: 2147483647")
+
+    {:ok, %{headers: headers}} = Parser.parse(message)
+    assert headers.max_forwards == 70
+    assert headers.timestamp == {54.21, 1.5}
+    assert headers.expires == 2_147_483_647
+
+    overflow = String.replace(@message, "CSeq: 1 INVITE",
+        "CSeq: 2147483648 INVITE")
+    assert Parser.parse(overflow) == {:error, :invalid_sequence}
+
+    garbage = String.replace(@message, "Max-Forwards: 70",
+        "Timestamp: 54.21x")
+    assert Parser.parse(garbage) == {:error, :invalid_timestamp}
+  end
+
+  test "decodes dates, counting the ones in unusual formats" do
+    date = fn value ->
+      message = String.replace(@message, "Max-Forwards: 70", "Date: " <> value)
+      {:ok, %{headers: %{date: date}}} = Parser.parse(message)
+      date
+    end
+
+    %{date_fallbacks: fallbacks} = Parser.stats()
+    assert date.("Sun, 06 Nov 1994 08:49:37 GMT") ==
+           {{1994, 11, 6}, {8, 49, 37}, {0, 0}}
+    assert date.("Tue, 29 Feb 2000 23:59:59 GMT") ==
+           {{2000, 2, 29}, {23, 59, 59}, {0, 0}}
+
+    assert date.("Sunday, 06-Nov-94 08:49:37 GMT") ==
+           {{1994, 11, 6}, {8, 49, 37}, {0, 0}}
+    assert Parser.stats().date_fallbacks >= fallbacks + 1
+  end
+
+  test "returns numeric sent-by hosts as inet addresses" do
+    sent_by = fn value ->
+      message = String.replace(@message, "client.atlanta.example.com:5060",
+          value)
+      {:ok, %{headers: %{via: [{_, _, sent_by, _}]}}} =
+        Parser.parse(message, inet_addresses: true)
+      sent_by
+    end
+
+    assert sent_by.("192.0.2.1") == {{192, 0, 2, 1}, 5060}
+    assert sent_by.("192.0.2.1:5080") == {{192, 0, 2, 1}, 5080}
+    assert sent_by.("[2001:db8::1]:5061") ==
+           {{0x2001, 0xdb8, 0, 0, 0, 0, 0, 1}, 5061}
+    assert sent_by.("[::ffff:192.0.2.1]") ==
+           {{0, 0, 0, 0, 0, 0xffff, 0xc000, 0x201}, 5060}
+
+    assert sent_by.("client.atlanta.example.com") ==
+           {"client.atlanta.example.com", 5060}
+    assert sent_by.("192.0.2.256") == {"192.0.2.256", 5060}
+    assert sent_by.("[2001:db8::1::2]") == {"2001:db8::1::2", 5060}
+
+    message = String.replace(@message, "client.atlanta.example.com:5060",
+        "[2001:db8::1]")
+    {:ok, %{headers: %{via: [{_, _, {host, _}, _}]}}} = Parser.parse(message)
+    assert host == "2001:db8::1"
+    assert Sippet.Message.sent_by_host({0x2001, 0xdb8, 0, 0, 0, 0, 0, 1}) ==
+           "[2001:db8::1]"
+  end
+
+  test "decomposes URIs" do
+    assert Parser.parse_uri(
+             "SIPS:alice:secret@[2001:db8::1]:5061;Transport=TCP;lr" <>
+               "?subject=project%20x&priority=urgent") ==
+           {:ok, %{scheme: "sips", user: "alice", password: "secret",
+                   host: "2001:db8::1", port: 5061,
+                   parameters: %{"transport" => "TCP", "lr" => ""},
+                   headers: %{"subject" => "project x",
+                              "priority" => "urgent"}}}
+    assert Parser.parse_uri("tel:+1-201-555-0123;ext=1234") ==
+           {:ok, %{scheme: "tel", user: "+1-201-555-0123", password: nil,
+                   host: nil, port: nil, parameters: %{"ext" => "1234"},
+                   headers: %{}}}
+
+    for invalid <- ["sip:alice@", "sip:alice@host:65536", "sip:a@b;x=%2",
+                    "sip:a b@c", "http://example.com"] do
+      assert Parser.parse_uri(invalid) == {:error, :invalid_uri}
+    end
+
+    {:ok, %{start_line: start_line, headers: headers}} =
+      Parser.parse(@message, uris: true)
+    assert %{host: "biloxi.example.com", user: "bob",
+             parameters: %{"transport" => "tcp"}} = start_line.request_uri
+    assert {"Bob", %{host: "biloxi.example.com"}, %{}} = headers.to
+    assert [{"", %{host: "client.atlanta.example.com"}, %{}}] =
+             headers.contact
+
+    invalid = String.replace(@message, "sip:bob@biloxi", "sip:bob@@biloxi")
+    assert Parser.parse(invalid, uris: true) == :invalid_uri
+  end
+
+  test "compares and hashes URIs" do
+    equivalent = [
+      {"sip:%61lice@atlanta.com;transport=TCP",
+       "sip:alice@AtLanTa.CoM;Transport=tcp"},
+      {"sip:carol@chicago.com", "sip:carol@chicago.com;newparam=5"},
+      {"sip:carol@chicago.com;security=on", "sip:carol@chicago.com;newparam=5"},
+      {"sip:biloxi.com;transport=tcp;method=REGISTER?to=sip:bob%40biloxi.com",
+       "sip:biloxi.com;method=REGISTER;transport=tcp?to=sip:bob%40biloxi.com"},
+      {"sip:alice@atlanta.com?subject=project%20x&priority=urgent",
+       "sip:alice@atlanta.com?priority=urgent&subject=project%20x"},
+      {"sip:alice@[2001:DB8::1]", "sip:alice@[2001:db8:0:0::1]"},
+      {"tel:+1-201-555-0123;ext=1", "TEL:+1.201.555.0123;EXT=1"}
+    ]
+
+    for {uri1, uri2} <- equivalent do
+      assert Parser.uri_equal(uri1, uri2)
+      assert Parser.uri_equal(uri2, uri1)
+      assert Parser.uri_hash(uri1) == Parser.uri_hash(uri2)
+    end
+
+    different = [
+      {"SIP:ALICE@AtLanTa.CoM;Transport=udp",
+       "sip:alice@AtLanTa.CoM;Transport=UDP"},
+      {"sip:bob@biloxi.com", "sip:bob@biloxi.com:5060"},
+      {"sip:bob@biloxi.com", "sip:bob@biloxi.com;transport=udp"},
+      {"sip:bob@biloxi.com", "sip:bob@biloxi.com:6000;transport=tcp"},
+      {"sip:carol@chicago.com", "sip:carol@chicago.com?Subject=next%20meeting"},
+      {"sip:bob@phone21.boxesbybob.com", "sip:bob@192.0.2.4"},
+      {"sips:alice@atlanta.com", "sip:alice@atlanta.com"}
+    ]
+
+    for {uri1, uri2} <- different do
+      refute Parser.uri_equal(uri1, uri2)
+      refute Parser.uri_equal(uri2, uri1)
+    end
+
+    assert Parser.uri_hash("sip:alice@atlanta.com") in 0..(2 ** 64 - 1)
+
+    assert_raise ArgumentError, fn ->
+      Parser.uri_equal("http://example.com", "sip:alice@atlanta.com")
+    end
+  end
+
+  test "serializes messages" do
+    raw = """
+    INVITE sip:bob@biloxi.com SIP/2.0
+    Via: SIP/2.0/UDP [2001:db8::1]:5060;received="a b";branch=z9hG4bK776asdhds
+    To: Bob <sip:bob@biloxi.com>
+    From: "Alice" <sip:alice@atlanta.com>;tag=1928301774
+    CSeq: 314159 INVITE
+    Date: Sat, 13 Nov 2010 23:29:00 GMT
+    Timestamp: 54.5
+    Authorization: Digest username="bob", realm="biloxi.com", qop=auth
+    Authorization: Basic realm="atlanta.com"
+    Call-Info: <http://www.example.com/alice/photo.jpg> ;purpose=icon
+    Content-Type: application/sdp
+    Content-Length: 4
+
+    v=0
+    """
+
+    {:ok, message} = Parser.parse(raw)
+    serialized = Parser.serialize(message)
+    assert Parser.parse(serialized) == {:ok, message}
+    assert serialized =~ "\r\nAuthorization: Basic realm=\"atlanta.com\"\r\n"
+    assert serialized =~ "\r\nVia: SIP/2.0/UDP [2001:db8::1]:5060;"
+    assert serialized =~ "\r\nCall-Info: <http://www.example.com/alice/photo.jpg>;purpose=icon\r\n"
+
+    message = %{message | headers: Map.delete(message.headers, :content_length), body: "é"}
+    assert Parser.serialize(message) =~ "\r\nContent-Length: 2\r\n"
+
+    assert_raise ArgumentError, fn ->
+      Parser.serialize(%{message | headers: %{unknown: "value"}})
+    end
+
+    # Values are written in the format of their header, not guessed from
+    # their shape.
+    assert_raise ArgumentError, fn ->
+      Parser.serialize(%{message | headers: %{content_length: "2"}})
+    end
+
+    assert_raise ArgumentError, fn ->
+      Parser.serialize(%{message | headers: %{cseq: {1, 0}}})
+    end
+  end
+
+  test "serializes with compact header forms near the MTU" do
+    {:ok, message} = Parser.parse(@message)
+    full = Parser.serialize(message)
+
+    assert Parser.serialize(message, mtu: byte_size(full) + 200) == {:ok, full}
+
+    {:ok, compact} = Parser.serialize(message, mtu: byte_size(full) + 199)
+    assert byte_size(compact) < byte_size(full)
+    assert compact =~ "\r\nv: SIP/2.0/TCP "
+    assert compact =~ "\r\nf: "
+    assert Parser.parse(compact) == {:ok, message}
+
+    assert Parser.serialize(message, mtu: byte_size(compact) + 199) ==
+             {:needs_stream_transport, full}
+  end
+
+  test "copies the raw lines of unchanged headers" do
+    raw =
+      "INVITE sip:bob@biloxi.com SIP/2.0\r\n" <>
+        "Via: SIP/2.0/UDP  pc33.atlanta.com ;branch=z9hG4bK776asdhds\r\n" <>
+        "Contact:   <sip:alice@pc33.atlanta.com>;q=0.5\r\n" <>
+        "Authorization: Digest username=\"bob\",\r\n realm=\"biloxi.com\"\r\n" <>
+        "Max-Forwards: 70\r\n" <>
+        "Content-Length: 0\r\n\r\n"
+
+    {:ok, message} = Parser.parse(raw, raw_headers: true)
+
+    assert message.raw_headers.max_forwards == {70, ["Max-Forwards: 70"]}
+    assert Parser.parse(raw) == {:ok, Map.delete(message, :raw_headers)}
+
+    # The lines are copies, unless sub-binaries are allowed.
+    {_, [line]} = message.raw_headers.via
+    assert :binary.referenced_byte_size(line) == byte_size(line)
+    {:ok, pinned} =
+      Parser.parse(raw, raw_headers: true, sub_binaries: true, min_sub_binary_size: 1)
+    {_, [line]} = pinned.raw_headers.via
+    assert :binary.referenced_byte_size(line) == byte_size(raw)
+
+    message = put_in(message.headers.max_forwards, 69)
+    serialized = Parser.serialize(message)
+
+    assert serialized =~ "\r\nMax-Forwards: 69\r\n"
+    assert serialized =~ "\r\nVia: SIP/2.0/UDP  pc33.atlanta.com ;branch=z9hG4bK776asdhds\r\n"
+    assert serialized =~ "\r\nContact:   <sip:alice@pc33.atlanta.com>;q=0.5\r\n"
+    assert serialized =~ "\r\nAuthorization: Digest username=\"bob\",\r\n realm=\"biloxi.com\"\r\n"
+
+    {:ok, message} = Sippet.Message.parse(raw, raw_headers: true)
+    message = Sippet.Message.put_header(message, :max_forwards, 69)
+    assert Sippet.Message.to_string(message) == serialized
+  end
+
+  test "edits messages for forwarding" do
+    raw =
+      "INVITE sip:bob@biloxi.com SIP/2.0\r\n" <>
+        "Via: SIP/2.0/UDP 192.0.2.4:5070;branch=z9hG4bK776asdhds;rport\r\n" <>
+        "Route: <sip:p1.example.com;lr>,\r\n <sip:p2.example.com;lr>\r\n" <>
+        "Max-Forwards: 10\r\n" <>
+        "Content-Length: 4\r\n\r\nv=0\n"
+
+    {:ok, iodata} =
+      Parser.edit(raw, [
+        {:add_via, "SIP/2.0/UDP proxy.example.com;branch=z9hG4bKnew"},
+        {:received, "198.51.100.7", 40000},
+        :pop_route,
+        :decrement_max_forwards,
+        {:add_record_route, "<sip:proxy.example.com;lr>"}
+      ])
+
+    assert IO.iodata_to_binary(iodata) ==
+             "INVITE sip:bob@biloxi.com SIP/2.0\r\n" <>
+               "Via: SIP/2.0/UDP proxy.example.com;branch=z9hG4bKnew\r\n" <>
+               "Via: SIP/2.0/UDP 192.0.2.4:5070;branch=z9hG4bK776asdhds" <>
+               ";received=198.51.100.7;rport=40000\r\n" <>
+               "Route: <sip:p2.example.com;lr>\r\n" <>
+               "Max-Forwards: 9\r\n" <>
+               "Content-Length: 4\r\n" <>
+               "Record-Route: <sip:proxy.example.com;lr>\r\n\r\nv=0\n"
+
+    assert {:ok, iodata} = Parser.edit(raw, [{:received, "192.0.2.4", 5070}, :pop_route])
+    assert IO.iodata_to_binary(iodata) =~ ";rport\r\nRoute: <sip:p2.example.com;lr>\r\nMax"
+
+    {:ok, iodata} = Parser.edit(iodata |> IO.iodata_to_binary(), [:pop_route])
+    refute IO.iodata_to_binary(iodata) =~ "Route"
+
+    {:ok, iodata} = Parser.edit(raw, [:pop_route, :pop_route, :pop_route])
+    refute IO.iodata_to_binary(iodata) =~ "Route"
+
+    assert Parser.edit(raw, [:decrement_max_forwards, :decrement_max_forwards]) ==
+             {:error, :overlapping_edits}
+
+    raw = String.replace(raw, "Max-Forwards: 10", "Max-Forwards: 0")
+    assert Parser.edit(raw, [:decrement_max_forwards]) == {:error, :too_many_hops}
+
+    assert_raise ArgumentError, fn -> Parser.edit(raw, [{:add_via, "a\r\nb"}]) end
+
+    assert_raise ArgumentError, fn ->
+      Parser.edit(raw, [{:received, "192.0.2.4;maddr=evil.example.com", 5070}])
+    end
+
+    assert_raise ArgumentError, fn -> Parser.edit(raw, [{:received, "[2001:db8::1]", 5070}]) end
+  end
+
+  defp chunks(binary, size) when byte_size(binary) <= size, do: [binary]
+
+  defp chunks(binary, size) do
+    <<chunk::binary-size(size), rest::binary>> = binary
+    [chunk | chunks(rest, size)]
+  end
+end
@@ -2,6 +2,7 @@ defmodule Sippet.Router.Test do
   use ExUnit.Case, async: false
 
   import Mock
+  import Sippet, only: [sigil_K: 2]
 
   alias Sippet.Transactions.Server.State
 
@@ -45,6 +46,50 @@ defmodule Sippet.Router.Test do
     end
   end
 
+  test "incoming datagram, numeric sent-by host" do
+    with_mocks [
+      {Registry, [],
+       [
+         lookup: fn _, _ -> [] end
+       ]},
+      {DynamicSupervisor, [],
+       [
+         start_child: fn _, {_, [%State{request: request}, _]} ->
+           [{_, _, {{192, 0, 2, 1}, 5060}, params}] = request.headers.via
+           false = Map.has_key?(params, "received")
+           {:ok, self()}
+         end
+       ]}
+    ] do
+      from = {:udp, {192, 0, 2, 1}, 5060}
+
+      packet = """
+      REGISTER sip:biloxi.example.com SIP/2.0
+      Via: SIP/2.0/UDP 192.0.2.1:5060;branch=z9hG4bK74b21
+      Max-Forwards: 70
+      From: Bob <sip:bob@biloxi.example.com>;tag=a73kszlfl
+      To: Bob <sip:bob@biloxi.example.com>
+      Call-ID: 1j9FpLxk3uxtm8tn@biloxi.example.com
+      CSeq: 1 REGISTER
+      Contact: <sip:bob@192.0.2.1>
+      Content-Length: 0
+      """
+
+      Sippet.Router.handle_transport_message(:sippet, packet, from)
+
+      assert called(
+               Registry.lookup(:sippet, {:transaction, ~K[z9hG4bK74b21|REGISTER|192.0.2.1:5060]})
+             )
+
+      assert called(
+               DynamicSupervisor.start_child(
+                 Sippet.supervisor_name(:sippet),
+                 {Sippet.Transactions.Server.NonInvite, :_}
+               )
+             )
+    end
+  end
+
   @test_body """
   v=0
   o=alice 2890844526 2890844526 IN IP4 foo.bar.com